@@ -4,22 +4,29 @@
 std::chrono::steady_clock::time_point t0;
 std::chrono::steady_clock::time_point t1;
 
+stone::topic_handle<rgb_t> color_topic;
+
 void publish_task()
 {
     // t1 = stone::timepoint_now();
     // printf("Time=%lld \r\n", std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count());
     // t0 = t1;
-    auto msg = std::make_shared<rgb_t>();
+    auto msg = color_topic.loan();
+    if (msg == nullptr)
+    {
+        printf("Publish: pool exhausted\r\n");
+        return;
+    }
     msg->r = 100;
     msg->g = 200;
     msg->b = 255;
-    stone::publish("color", msg);
+    stone::publish(color_topic, msg);
     printf("Publish: rgb=(%d,%d,%d)\r\n", msg->r, msg->g, msg->b);
-    stone::emitEvent("color_event");
 }
 
 void example_pub_main()
 {
+    color_topic = stone::advertise<rgb_t>("color", 16);
     auto task = stone::make_interval_task(publish_task);
     stone::scheduleInterval(task, 100_ms);
-}
\ No newline at end of file
+}
@@ -9,14 +9,8 @@ void rgb_handler(const std::shared_ptr<rgb_t> &msg)
 
 stone::subscriber<rgb_t> *subscriber1;
 
-void handle()
-{
-    subscriber1->spin();
-}
-
 void example_sub_main()
 {
-    subscriber1 = stone::subscribe<rgb_t>("color", rgb_handler);
-    auto task = stone::make_event_task(handle);
-    stone::scheduleEvent(task, "color_event");
+    // the callback runs on the default pool whenever a message arrives
+    subscriber1 = stone::subscribe<rgb_t>("color", rgb_handler, stone::executor_options());
 }
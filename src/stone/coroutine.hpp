@@ -0,0 +1,469 @@
+#ifndef STONE_COROUTINE_HPP
+#define STONE_COROUTINE_HPP
+
+// coroutines need C++20, configure with -DSTONE_CXX20=ON
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "datafly.hpp"
+#include "scheduler.hpp"
+
+#define STONE_HAS_COROUTINES 1
+
+namespace stone
+{
+    template <class _T = void>
+    class task;
+
+    // State shared by every coroutine type of stone. The awaitables below read the pool
+    // from it, so a coroutine always resumes on the pool it was started on.
+    class task_promise_base
+    {
+    public:
+        // hands the thread over to the awaiting coroutine, if there is one
+        class final_awaiter
+        {
+        public:
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            template <class _P>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<_P> h) noexcept
+            {
+                auto next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        final_awaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void unhandled_exception()
+        {
+            this->exception = std::current_exception();
+        }
+
+        ThreadPool *pool = nullptr;
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+    };
+
+    template <class _T>
+    class task_promise : public task_promise_base
+    {
+    public:
+        task<_T> get_return_object();
+
+        template <class _U>
+        void return_value(_U &&value)
+        {
+            this->result.emplace(std::forward<_U>(value));
+        }
+
+        _T take()
+        {
+            if (this->exception)
+            {
+                std::rethrow_exception(this->exception);
+            }
+            return std::move(*this->result);
+        }
+
+    private:
+        std::optional<_T> result;
+    };
+
+    template <>
+    class task_promise<void> : public task_promise_base
+    {
+    public:
+        task<void> get_return_object();
+
+        void return_void() {}
+
+        void take()
+        {
+            if (this->exception)
+            {
+                std::rethrow_exception(this->exception);
+            }
+        }
+    };
+
+    // Lazily started coroutine. It runs when it is awaited by another coroutine, on that
+    // coroutine's pool, or when it is handed to spawn(). While it waits for a timer, an event,
+    // a message or another task it holds no worker thread.
+    template <class _T>
+    class task
+    {
+        friend class task_promise<_T>;
+
+    public:
+        using promise_type = task_promise<_T>;
+
+        class awaiter
+        {
+        public:
+            explicit awaiter(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+            bool await_ready() const noexcept
+            {
+                return this->handle.done();
+            }
+
+            // starts the task right away on the awaiting thread
+            template <class _P>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<_P> caller) noexcept
+            {
+                this->handle.promise().continuation = caller;
+                this->handle.promise().pool = caller.promise().pool;
+                return this->handle;
+            }
+
+            _T await_resume()
+            {
+                return this->handle.promise().take();
+            }
+
+        private:
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        task(task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+        task(const task &) = delete;
+        task &operator=(const task &) = delete;
+        task &operator=(task &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (this->handle)
+                {
+                    this->handle.destroy();
+                }
+                this->handle = std::exchange(other.handle, nullptr);
+            }
+            return *this;
+        }
+        ~task()
+        {
+            if (this->handle)
+            {
+                this->handle.destroy();
+            }
+        }
+
+        awaiter operator co_await() const noexcept
+        {
+            return awaiter(this->handle);
+        }
+
+    private:
+        explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    template <class _T>
+    inline task<_T> task_promise<_T>::get_return_object()
+    {
+        return task<_T>(std::coroutine_handle<task_promise<_T>>::from_promise(*this));
+    }
+
+    inline task<void> task_promise<void>::get_return_object()
+    {
+        return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+    }
+
+    // frame of a spawned task, it frees itself when the task is done
+    class spawned_task
+    {
+    public:
+        class promise_type : public task_promise_base
+        {
+        public:
+            spawned_task get_return_object()
+            {
+                return spawned_task{std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+
+            std::suspend_never final_suspend() noexcept
+            {
+                return {};
+            }
+
+            void return_void() {}
+        };
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    template <class _T>
+    inline spawned_task spawn_frame(task<_T> t, std::promise<_T> result)
+    {
+        try
+        {
+            if constexpr (std::is_void<_T>::value)
+            {
+                co_await t;
+                result.set_value();
+            }
+            else
+            {
+                result.set_value(co_await t);
+            }
+        }
+        catch (...)
+        {
+            result.set_exception(std::current_exception());
+        }
+    }
+
+    // starts the task on a worker of the pool. the future is only for callers outside
+    // the pool, a coroutine should co_await the task instead.
+    template <class _T>
+    inline std::future<_T> spawn(task<_T> t, ThreadPool *pool = &defaultPool)
+    {
+        std::promise<_T> result;
+        auto future = result.get_future();
+        auto frame = spawn_frame(std::move(t), std::move(result)).handle;
+        frame.promise().pool = pool;
+        pool->submit([frame]()
+                     { frame.resume(); });
+        return future;
+    }
+
+    // co_await resume_on(pool) continues the coroutine, and everything it awaits later, on pool
+    class resume_on
+    {
+    public:
+        explicit resume_on(ThreadPool *pool) : pool(pool) {}
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        template <class _P>
+        void await_suspend(std::coroutine_handle<_P> h)
+        {
+            h.promise().pool = this->pool;
+            this->pool->submit([h]()
+                               { h.resume(); });
+        }
+
+        void await_resume() noexcept {}
+
+    private:
+        ThreadPool *pool;
+    };
+
+    // resumes the coroutine on its pool once the scheduler's timer expires,
+    // the scheduler must be running
+    class sleep_awaiter
+    {
+    public:
+        sleep_awaiter(Scheduler *scheduler, const std::chrono::steady_clock::time_point &tp)
+            : scheduler(scheduler), tp(tp) {}
+
+        bool await_ready() const
+        {
+            return timepoint_now() >= this->tp;
+        }
+
+        template <class _P>
+        bool await_suspend(std::coroutine_handle<_P> h)
+        {
+            auto item = std::make_shared<WorkItem>();
+            item->fn = [h]()
+            { h.resume(); };
+            item->set_pool(h.promise().pool);
+            return this->scheduler->scheduleAt(item, this->tp).valid();
+        }
+
+        void await_resume() noexcept {}
+
+    private:
+        Scheduler *scheduler;
+        std::chrono::steady_clock::time_point tp;
+    };
+
+    inline sleep_awaiter sleep_until(const std::chrono::steady_clock::time_point &tp,
+                                     Scheduler *scheduler = &defaultScheduler)
+    {
+        return sleep_awaiter(scheduler, tp);
+    }
+
+    inline sleep_awaiter sleep_for(unsigned long long us, Scheduler *scheduler = &defaultScheduler)
+    {
+        return sleep_awaiter(scheduler, timepoint_shift(us));
+    }
+
+    // resumes the coroutine on its pool at the next emit of the event.
+    // emits before the co_await are not remembered, like for event tasks.
+    // yields false right away if the event is not registered.
+    class event_awaiter
+    {
+    public:
+        event_awaiter(Scheduler *scheduler, EventId event) : scheduler(scheduler), event(event) {}
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        template <class _P>
+        bool await_suspend(std::coroutine_handle<_P> h)
+        {
+            auto item = std::make_shared<WorkItem>();
+            item->fn = [h]()
+            { h.resume(); };
+            item->set_pool(h.promise().pool);
+            if (this->scheduler->scheduleEvent(item, this->event))
+            {
+                // the coroutine may already run elsewhere, the awaiter must not be touched
+                return true;
+            }
+            this->registered = false;
+            return false;
+        }
+
+        bool await_resume() const noexcept
+        {
+            return this->registered;
+        }
+
+    private:
+        Scheduler *scheduler;
+        EventId event;
+        bool registered = true;
+    };
+
+    inline event_awaiter wait_event(EventId event, Scheduler *scheduler = &defaultScheduler)
+    {
+        return event_awaiter(scheduler, event);
+    }
+
+    inline event_awaiter wait_event(const std::string &event, Scheduler *scheduler = &defaultScheduler)
+    {
+        return event_awaiter(scheduler, scheduler->registerEvent(event));
+    }
+
+    // Subscriber for coroutines: co_await next() yields the next message of the topic.
+    // A message published while a coroutine waits is handed over directly and the coroutine
+    // resumes on its pool. Otherwise it is queued, and dropped when the queue is full.
+    // Only one coroutine at a time may wait on a subscriber.
+    template <class _T>
+    class awaitable_subscriber : public subscriber_base
+    {
+    public:
+        class next_awaiter
+        {
+        public:
+            explicit next_awaiter(awaitable_subscriber *s) : s(s) {}
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            template <class _P>
+            bool await_suspend(std::coroutine_handle<_P> h)
+            {
+                std::lock_guard<std::mutex> glock(s->mtx);
+                if (s->msgs.pop(s->handoff))
+                {
+                    return false;
+                }
+                s->waiter = h;
+                s->waiter_pool = h.promise().pool;
+                return true;
+            }
+
+            std::shared_ptr<_T> await_resume()
+            {
+                return std::move(s->handoff);
+            }
+
+        private:
+            awaitable_subscriber *s;
+        };
+
+        using message_type = _T;
+
+        awaitable_subscriber(const std::string &topic_name, std::size_t queue_size)
+            : msgs(queue_size)
+        {
+            this->topic_name = topic_name;
+        }
+        ~awaitable_subscriber() {}
+
+        next_awaiter next()
+        {
+            return next_awaiter(this);
+        }
+
+    private:
+        void deliver(const void *msg) override
+        {
+            auto &ptr = *static_cast<const std::shared_ptr<_T> *>(msg);
+            std::coroutine_handle<> h;
+            ThreadPool *pool = nullptr;
+            {
+                std::lock_guard<std::mutex> glock(mtx);
+                if (!waiter)
+                {
+                    msgs.push_single(ptr);
+                    return;
+                }
+                h = std::exchange(waiter, nullptr);
+                pool = waiter_pool;
+                handoff = ptr;
+            }
+            pool->submit([h]()
+                         { h.resume(); });
+        }
+
+        // publishers serialize on it, it also hands the waiter over
+        std::mutex mtx;
+        BoundedRing<std::shared_ptr<_T>> msgs;
+        std::coroutine_handle<> waiter;
+        ThreadPool *waiter_pool = nullptr;
+        std::shared_ptr<_T> handoff;
+    };
+
+    // returns nullptr if the topic carries another message type
+    template <class _T>
+    inline awaitable_subscriber<_T> *subscribe_awaitable(const std::string &topic_name, std::size_t queue_size = 10)
+    {
+        auto s = new awaitable_subscriber<_T>(topic_name, queue_size);
+        if (master.add_subscriber(s) == nullptr)
+        {
+            delete s;
+            return nullptr;
+        }
+        return s;
+    }
+
+} // namespace stone
+
+#endif
+
+#endif
@@ -1,109 +1,770 @@
 #ifndef STONE_DATAFLY_HPP
 #define STONE_DATAFLY_HPP
 
+#include <cstring>
 #include <mutex>
-#include <queue>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
 #include <memory>
 #include <unordered_map>
 #include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "stoneconfig.hpp"
+#include "ringbuffer.hpp"
+#include "messagepool.hpp"
+#include "shmring.hpp"
+#include "scheduler.hpp"
 
 namespace stone
 {
     template <class _T>
     using topic_callback = std::function<void(const std::shared_ptr<_T> &)>;
 
+    // A topic declared at compile time, e.g.
+    //     constexpr stone::Topic<rgb_t> COLOR{1, "color"};
+    // The message type is part of the declaration, so publishing or subscribing with another
+    // type does not compile. The id, below DATAFLY_STATIC_TOPICS and unique in the program,
+    // picks a slot of the master's static table, publishing does not hash the name. The name
+    // is the same topic that string-named publishers and subscribers use.
+    template <class _T>
+    class Topic
+    {
+    public:
+        using message_type = _T;
+
+        constexpr Topic(uint32_t id, const char *name) : id(id), name(name) {}
+
+        const uint32_t id;
+        const char *const name;
+    };
+
+    // one address per message type, identifies the type a topic carries
     template <class _T>
-    class subscriber
+    inline const char topic_type_tag = 0;
+
+    // How a subscriber receives the messages of a topic.
+    enum class Transport
+    {
+        // only messages published in this process
+        LOCAL,
+        // also the messages other processes publish to the topic's shared memory ring,
+        // see DataFlyMaster::share. the message type must be trivially copyable.
+        SHM,
+    };
+
+    // Lets the arrival of a message run the callback on a thread pool, no spin() needed.
+    class executor_options
+    {
+    public:
+        // nullptr for defaultPool
+        ThreadPool *pool = nullptr;
+        // messages handled by one task before it yields the worker
+        std::size_t batch = 16;
+        // at most one callback of the subscriber runs at a time, in message order.
+        // otherwise up to one task per worker drains the queue concurrently.
+        bool exclusive = true;
+        std::size_t priority = 0;
+    };
+
+    // Counts the drain tasks of an executor driven queue that are scheduled or running, in one
+    // word together with a flag that a message arrived since a task last looked at the queue.
+    // A task gives up its count with a CAS that fails if the flag got set meanwhile, so no
+    // message is left behind, and that CAS is the task's last access to the owner: once
+    // count() is 0 nothing of the owner is touched any more.
+    class drain_tasks
+    {
+    public:
+        // called after a message was queued, returns true if the caller has to submit a task
+        bool request(std::size_t max_tasks)
+        {
+            std::size_t s = state.fetch_or(ARRIVED) | ARRIVED;
+            while ((s >> 1) < max_tasks)
+            {
+                if (state.compare_exchange_weak(s, s + ONE))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // called by a task after its batch. returns true if the queue is not empty, the task
+        // keeps its count and has to be submitted again. otherwise the count is given up and
+        // the task must not touch the owner any more.
+        template <class Empty>
+        bool finish(Empty &&empty)
+        {
+            std::size_t s = state.load();
+            while (true)
+            {
+                if (!empty())
+                {
+                    return true;
+                }
+                if (s & ARRIVED)
+                {
+                    // the queue is checked again after clearing the flag
+                    state.compare_exchange_weak(s, s & ~ARRIVED);
+                    s = state.load();
+                    continue;
+                }
+                if (state.compare_exchange_weak(s, s - ONE))
+                {
+                    return false;
+                }
+            }
+        }
+
+        // tasks scheduled or running
+        std::size_t count() const
+        {
+            return state.load() >> 1;
+        }
+
+    private:
+        static constexpr std::size_t ARRIVED = 1;
+        static constexpr std::size_t ONE = 2;
+
+        std::atomic<std::size_t> state{0};
+    };
+
+    // Common part of every subscriber type, publishers reach the subscribers of a topic through it.
+    class subscriber_base
     {
         friend class DataFlyMaster;
 
     public:
+        virtual ~subscriber_base() {}
+
+        const std::string &topic() const
+        {
+            return this->topic_name;
+        }
+
+        // no callback of this subscriber is running or scheduled
+        virtual bool idle() const
+        {
+            return true;
+        }
+
+    protected:
+        // msg points to the std::shared_ptr of the topic's message type
+        virtual void deliver(const void *msg) = 0;
+
+        std::string topic_name;
+    };
+
+    template <class _T>
+    class subscriber : public subscriber_base
+    {
+        friend class DataFlyMaster;
+
+    public:
+        using message_type = _T;
+
+        // single_publisher: only one thread ever publishes to the topic,
+        // the queue can then skip the CAS on the producer side.
         subscriber(const std::string &topic_name,
                    const topic_callback<_T> &cb,
-                   std::size_t _queue_max_size)
+                   std::size_t _queue_max_size,
+                   bool single_publisher = false)
+            : msgs(_queue_max_size)
         {
             this->topic_name = topic_name;
             this->queue_max_size = _queue_max_size;
             this->callback = cb;
+            this->single_publisher = single_publisher;
+#if STONE_TRACE_ENABLE
+            this->trace_name = traceName(topic_name);
+#endif
+        }
+        // the arrival of a message schedules the callback on options.pool
+        subscriber(const std::string &topic_name,
+                   const topic_callback<_T> &cb,
+                   const executor_options &options,
+                   std::size_t _queue_max_size,
+                   bool single_publisher = false)
+            : subscriber(topic_name, cb, _queue_max_size, single_publisher)
+        {
+            this->executor = options;
+            if (this->executor.pool == nullptr)
+            {
+                this->executor.pool = &defaultPool;
+            }
+            if (this->executor.batch == 0)
+            {
+                this->executor.batch = 1;
+            }
+            this->max_inflight = options.exclusive ? 1 : this->executor.pool->size();
         }
         ~subscriber() {}
 
         void spin(bool block = false)
         {
             std::shared_ptr<_T> msg = nullptr;
-
-            mtx_msgs.lock();
-            if (!msgs.empty())
+            if (msgs.pop(msg) || pull_remote(msg))
             {
-                msg = msgs.front();
-                msgs.pop();
+                STONE_TRACE_BEGIN("spin", trace_name, 1);
+                this->callback(msg);
+                STONE_TRACE_END("spin", trace_name, 1);
             }
-            mtx_msgs.unlock();
-            if (msg != nullptr)
+        }
+
+        // runs the callback for up to max_n queued messages, returns how many there were.
+        std::size_t spin_some(std::size_t max_n)
+        {
+            std::size_t n = 0;
+            std::shared_ptr<_T> msg = nullptr;
+            while (n < max_n && (msgs.pop(msg) || pull_remote(msg)))
             {
+                STONE_TRACE_BEGIN("spin", trace_name, n);
                 this->callback(msg);
+                STONE_TRACE_END("spin", trace_name, n);
+                msg = nullptr;
+                n++;
             }
+            return n;
+        }
+
+        bool executor_driven() const
+        {
+            return executor.pool != nullptr;
+        }
+
+        // messages of other processes that were overwritten before this subscriber read them
+        std::size_t remote_lost() const
+        {
+            return lost;
+        }
+
+        // number of drain tasks scheduled or running
+        std::size_t inflight() const
+        {
+            return drains.count();
+        }
+
+        // no drain task is scheduled and none touches the subscriber any more
+        bool idle() const override
+        {
+            return drains.count() == 0;
         }
 
     private:
+        void deliver(const void *msg) override
+        {
+            push(*static_cast<const std::shared_ptr<_T> *>(msg));
+        }
+
+        // never blocks and never allocates, returns false when the queue is full.
         bool push(const std::shared_ptr<_T> &msg)
         {
-            std::lock_guard<std::mutex> glock(mtx_msgs);
-            if (msgs.size() >= this->queue_max_size)
+            bool pushed = single_publisher ? msgs.push_single(msg) : msgs.push(msg);
+            if (pushed && executor.pool != nullptr && drains.request(max_inflight))
+            {
+                submit_drain();
+            }
+            return pushed;
+        }
+
+        void submit_drain()
+        {
+            // the capture fits inline, a warmed-up pool submits without allocating
+            executor.pool->submit([this]()
+                                  { this->drain(); },
+                                  executor.priority);
+        }
+
+        void drain()
+        {
+            spin_some(executor.batch);
+            // once finish gives up the task's count the subscriber may be gone, see idle()
+            if (drains.finish([this]()
+                              { return msgs.empty(); }))
+            {
+                // more to do, but let other tasks of the pool run first
+                submit_drain();
+            }
+        }
+
+        // copies the next message another process published out of the shared memory ring.
+        // the copy goes into a reused message unless the last one is still referenced.
+        bool pull_remote(std::shared_ptr<_T> &msg)
+        {
+            if (remote == nullptr)
             {
                 return false;
             }
-            msgs.push(msg);
-            return true;
+            if (remote_msg == nullptr || remote_msg.use_count() > 1)
+            {
+                remote_msg = std::make_shared<_T>();
+            }
+            uint64_t origin = 0;
+            while (remote->read(cursor, remote_msg.get(), origin, lost))
+            {
+                // publishes of this process already arrived through the local queue
+                if (origin != ShmRing::processId())
+                {
+                    msg = remote_msg;
+                    return true;
+                }
+            }
+            return false;
         }
 
         std::size_t queue_max_size;
-        std::string topic_name;
+        bool single_publisher = false;
 
-        std::mutex mtx_msgs;
-        std::queue<std::shared_ptr<_T>> msgs;
+        BoundedRing<std::shared_ptr<_T>> msgs;
 
         topic_callback<_T> callback;
+
+        // used with Transport::SHM, only one thread at a time may spin then
+        std::unique_ptr<ShmRing> remote;
+        uint64_t cursor = 0;
+        std::size_t lost = 0;
+        std::shared_ptr<_T> remote_msg;
+
+        // interned topic name for trace events
+        const char *trace_name = nullptr;
+
+        // used when executor driven
+        executor_options executor;
+        std::size_t max_inflight = 1;
+        drain_tasks drains;
     };
 
-    class DataFlyMaster
+    // Keep-latest mailbox for state topics (pose, battery, ...): every publish overwrites the
+    // previous value, nothing queues up and nothing is dropped in favour of older data.
+    // Publishers write under a seqlock, readers copy the value without a lock and retry if a
+    // write overlapped. The value lives in relaxed atomic words, so racing copies are well defined.
+    template <class _T>
+    class latest_subscriber : public subscriber_base
+    {
+        friend class DataFlyMaster;
+        static_assert(std::is_trivially_copyable<_T>::value, "latest_subscriber needs a trivially copyable message type");
+
+    public:
+        using message_type = _T;
+
+        explicit latest_subscriber(const std::string &topic_name)
+        {
+            this->topic_name = topic_name;
+            for (auto &&w : words)
+            {
+                w.store(0, std::memory_order_relaxed);
+            }
+        }
+        ~latest_subscriber() {}
+
+        // copies the newest value into out and returns its version, which counts the publishes.
+        // returns 0 and leaves out alone if nothing was published yet.
+        uint64_t read(_T &out) const
+        {
+            uint64_t buffer[WORD_COUNT];
+            while (true)
+            {
+                uint64_t begin = seq.load(std::memory_order_acquire);
+                if (begin & 1)
+                {
+                    continue;
+                }
+                if (begin == 0)
+                {
+                    return 0;
+                }
+                for (std::size_t i = 0; i < WORD_COUNT; i++)
+                {
+                    buffer[i] = words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq.load(std::memory_order_relaxed) == begin)
+                {
+                    std::memcpy(&out, buffer, sizeof(_T));
+                    return begin / 2;
+                }
+            }
+        }
+
+        // version of the newest value, 0 if nothing was published yet
+        uint64_t version() const
+        {
+            return seq.load(std::memory_order_acquire) / 2;
+        }
+
+        void write(const _T &value)
+        {
+            uint64_t buffer[WORD_COUNT] = {};
+            std::memcpy(buffer, &value, sizeof(_T));
+            // writers take the sequence from even to odd, so concurrent publishers serialize
+            uint64_t current = seq.load(std::memory_order_relaxed);
+            while ((current & 1) || !seq.compare_exchange_weak(current, current + 1, std::memory_order_acquire))
+            {
+                current = seq.load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            for (std::size_t i = 0; i < WORD_COUNT; i++)
+            {
+                words[i].store(buffer[i], std::memory_order_relaxed);
+            }
+            seq.store(current + 2, std::memory_order_release);
+        }
+
+    private:
+        static constexpr std::size_t WORD_COUNT = (sizeof(_T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        void deliver(const void *msg) override
+        {
+            auto &ptr = *static_cast<const std::shared_ptr<_T> *>(msg);
+            if (ptr)
+            {
+                write(*ptr);
+            }
+        }
+
+        // odd while a write is in progress
+        alignas(64) std::atomic<uint64_t> seq{0};
+        std::atomic<uint64_t> words[WORD_COUNT];
+    };
+
+    // Copies every message published in this process into the topic's shared memory ring.
+    template <class _T>
+    class shm_publisher : public subscriber_base
+    {
+    public:
+        shm_publisher(const std::string &topic_name, std::unique_ptr<ShmRing> ring) : ring(std::move(ring))
+        {
+            this->topic_name = topic_name;
+        }
+        ~shm_publisher() {}
+
+    private:
+        void deliver(const void *msg) override
+        {
+            auto &ptr = *static_cast<const std::shared_ptr<_T> *>(msg);
+            if (ptr)
+            {
+                ring->write(ptr.get(), ShmRing::processId());
+            }
+        }
+
+        std::unique_ptr<ShmRing> ring;
+    };
+
+    // Subscriber list of one topic.
+    // Publishers read the list without taking a lock. subscribe/unsubscribe replace the whole
+    // list (copy-on-write) and free the old one once no publisher can still be reading it.
+    class topic_entry
+    {
+        friend class DataFlyMaster;
+
+    public:
+        using subscriber_list = std::vector<subscriber_base *>;
+
+        explicit topic_entry(const std::string &name) : name(name), subscribers(new subscriber_list()) {}
+        ~topic_entry()
+        {
+            delete subscribers.load();
+        }
+
+        const std::string name;
+
+        template <class Fn>
+        inline void for_each(Fn &&fn)
+        {
+            // readers register on the counter of the current epoch,
+            // the writer waits for both counters to drain, see synchronize()
+            unsigned e = epoch.load();
+            readers[e & 1].fetch_add(1);
+            for (auto &&s : *subscribers.load())
+            {
+                fn(s);
+            }
+            readers[e & 1].fetch_sub(1);
+        }
+
+    private:
+        // replaces the list, the caller must serialize writers.
+        void replace(subscriber_list *next)
+        {
+            const subscriber_list *old = subscribers.exchange(next);
+            synchronize();
+            delete old;
+        }
+
+        // returns once every reader that could have seen the previous list is done.
+        void synchronize()
+        {
+            for (int round = 0; round < 2; round++)
+            {
+                unsigned e = epoch.fetch_add(1);
+                while (readers[e & 1].load() != 0)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        std::atomic<const subscriber_list *> subscribers;
+        // topic_type_tag of the message type, set by the first typed advertise or subscribe
+        std::atomic<const void *> type{nullptr};
+        // message_pool<_T> of the topic, created by the first advertise that asks for one
+        std::shared_ptr<void> pool;
+        // the shm_publisher<_T> of a shared topic
+        std::unique_ptr<subscriber_base> exporter;
+        alignas(64) std::atomic<unsigned> epoch{0};
+        std::atomic<std::size_t> readers[2] = {{0}, {0}};
+    };
+
+    // A topic resolved once, publishing through it takes no lock and does no lookup.
+    template <class _T>
+    class topic_handle
     {
+        friend class DataFlyMaster;
+
     public:
-        using generic_subscriber = subscriber<void *>;
+        topic_handle() {}
+        ~topic_handle() {}
+
+        bool valid() const
+        {
+            return entry != nullptr;
+        }
+
+        const std::string &name() const
+        {
+            return entry->name;
+        }
+
+        // borrows a message from the topic's pool, or allocates one if the topic has no pool.
+        // may return nullptr when the pool is exhausted, see message_pool::ExhaustedPolicy.
+        std::shared_ptr<_T> loan() const
+        {
+            if (msg_pool != nullptr)
+            {
+                return msg_pool->loan();
+            }
+            return std::make_shared<_T>();
+        }
+
+        // nullptr if the topic has no pool
+        message_pool<_T> *pool() const
+        {
+            return msg_pool;
+        }
+
+    private:
+        topic_handle(topic_entry *entry, message_pool<_T> *msg_pool) : entry(entry), msg_pool(msg_pool) {}
 
+        topic_entry *entry = nullptr;
+        message_pool<_T> *msg_pool = nullptr;
+    };
+
+    class DataFlyMaster
+    {
     public:
         DataFlyMaster() {}
         ~DataFlyMaster() {}
 
+        // pool_size > 0 gives the topic a pool of preallocated messages to loan from.
+        // the pool is shared by every handle of the topic, later pool arguments are ignored.
+        // the handle is invalid if the topic carries another message type.
+        template <class _T>
+        inline topic_handle<_T> advertise(const std::string &topic_name, std::size_t pool_size = 0,
+                                          typename message_pool<_T>::ExhaustedPolicy policy =
+                                              message_pool<_T>::ExhaustedPolicy::RETURN_NULL)
+        {
+            return advertise_entry<_T>(resolve(topic_name), pool_size, policy);
+        }
+
+        template <class _T>
+        inline topic_handle<_T> advertise(const Topic<_T> &topic, std::size_t pool_size = 0,
+                                          typename message_pool<_T>::ExhaustedPolicy policy =
+                                              message_pool<_T>::ExhaustedPolicy::RETURN_NULL)
+        {
+            topic_entry *entry = bind(topic);
+            return entry != nullptr ? advertise_entry<_T>(entry, pool_size, policy) : topic_handle<_T>();
+        }
+
+        template <class _T>
+        inline void publish(const topic_handle<_T> &topic, const std::shared_ptr<_T> &msg)
+        {
+            publish_entry(topic.entry, msg);
+        }
+
+        // the first publish fixes the message type of a topic nobody used yet.
+        // dropped if the topic carries another message type.
         template <class _T>
         inline void publish(const std::string &topic_name, const std::shared_ptr<_T> &msg)
         {
-            std::lock_guard<std::mutex> glock(mtx_subscribers);
-            for (auto &&s : subscribers[topic_name])
+            topic_entry *entry = resolve(topic_name);
+            if (claim_type<_T>(entry))
+            {
+                publish_entry(entry, msg);
+            }
+        }
+
+        // one load from the static table, no hashing. returns false if the id is out of range
+        // or another declaration bound the id or the name to another message type.
+        template <class _T>
+        inline bool publish(const Topic<_T> &topic, const std::shared_ptr<_T> &msg)
+        {
+            topic_entry *entry = bind(topic);
+            if (entry == nullptr)
+            {
+                return false;
+            }
+            publish_entry(entry, msg);
+            return true;
+        }
+
+        // returns nullptr if the topic carries another message type.
+        template <class _T>
+        inline subscriber<_T> *subscribe(const std::string &topic_name, topic_callback<_T> cb, std::size_t queue_size = 10,
+                                         bool single_publisher = false)
+        {
+            if (!claim_type<_T>(resolve(topic_name)))
             {
-                subscriber<_T> *sub = reinterpret_cast<subscriber<_T> *>(s);
-                sub->push(msg);
+                return nullptr;
             }
+            return add_subscriber(new subscriber<_T>(topic_name, cb, queue_size, single_publisher));
         }
 
+        // the callback runs on a thread pool whenever messages arrive
         template <class _T>
-        inline subscriber<_T> *subscribe(const std::string &topic_name, topic_callback<_T> cb, std::size_t queue_size = 10)
+        inline subscriber<_T> *subscribe(const std::string &topic_name, topic_callback<_T> cb,
+                                         const executor_options &options, std::size_t queue_size = 10,
+                                         bool single_publisher = false)
         {
+            if (!claim_type<_T>(resolve(topic_name)))
+            {
+                return nullptr;
+            }
+            return add_subscriber(new subscriber<_T>(topic_name, cb, options, queue_size, single_publisher));
+        }
+
+        // the callback type is not deduced, a lambda can be passed as it is
+        template <class _T>
+        inline subscriber<_T> *subscribe(const Topic<_T> &topic, topic_callback<typename Topic<_T>::message_type> cb,
+                                         std::size_t queue_size = 10, bool single_publisher = false)
+        {
+            if (bind(topic) == nullptr)
+            {
+                return nullptr;
+            }
+            return add_subscriber(new subscriber<_T>(topic.name, cb, queue_size, single_publisher));
+        }
+
+        template <class _T>
+        inline subscriber<_T> *subscribe(const Topic<_T> &topic, topic_callback<typename Topic<_T>::message_type> cb,
+                                         const executor_options &options, std::size_t queue_size = 10,
+                                         bool single_publisher = false)
+        {
+            if (bind(topic) == nullptr)
+            {
+                return nullptr;
+            }
+            return add_subscriber(new subscriber<_T>(topic.name, cb, options, queue_size, single_publisher));
+        }
+
+        // with Transport::SHM the subscriber also receives what other processes publish.
+        // returns nullptr if the shared memory ring cannot be opened.
+        template <class _T>
+        inline subscriber<_T> *subscribe(const std::string &topic_name, topic_callback<_T> cb,
+                                         Transport transport, std::size_t queue_size = 10)
+        {
+            static_assert(std::is_trivially_copyable<_T>::value, "shared memory topics need a trivially copyable message type");
+            if (!claim_type<_T>(resolve(topic_name)))
+            {
+                return nullptr;
+            }
+            auto s = new subscriber<_T>(topic_name, cb, queue_size);
+            if (transport == Transport::SHM)
+            {
+                s->remote = ShmRing::open(shm_name(topic_name), sizeof(_T), queue_size);
+                if (s->remote == nullptr)
+                {
+                    delete s;
+                    return nullptr;
+                }
+                // only messages published from now on
+                s->cursor = s->remote->tail();
+            }
+            return add_subscriber(s);
+        }
+
+        // copies every message published in this process into a shared memory ring of
+        // capacity messages, where Transport::SHM subscribers of other processes read it.
+        // local subscribers still get the published message itself.
+        // returns false if the ring cannot be opened, e.g. it holds another message size.
+        template <class _T>
+        inline bool share(const std::string &topic_name, std::size_t capacity = 64)
+        {
+            static_assert(std::is_trivially_copyable<_T>::value, "shared memory topics need a trivially copyable message type");
+            topic_entry *entry = resolve(topic_name);
+            if (!claim_type<_T>(entry))
+            {
+                return false;
+            }
             std::lock_guard<std::mutex> glock(mtx_subscribers);
-            subscriber<_T> *s = new subscriber<_T>(topic_name, cb, queue_size);
-            this->subscribers[topic_name].push_back(reinterpret_cast<generic_subscriber *>(s));
-            return s;
+            if (entry->exporter)
+            {
+                return true;
+            }
+            auto ring = ShmRing::open(shm_name(topic_name), sizeof(_T), capacity);
+            if (ring == nullptr)
+            {
+                return false;
+            }
+            entry->exporter = std::make_unique<shm_publisher<_T>>(topic_name, std::move(ring));
+            insert(entry, entry->exporter.get());
+            return true;
         }
 
+        // removes the shared memory ring of the topic from the system.
+        // processes that have it open keep using it, later ones get a new ring.
+        inline bool unlink_shared(const std::string &topic_name)
+        {
+            return ShmRing::unlink(shm_name(topic_name));
+        }
+
+        // the subscriber only keeps the newest message, see latest_subscriber.
+        // returns nullptr if the topic carries another message type.
         template <class _T>
-        inline bool unsubscribe(subscriber<_T> *_subscriber)
+        inline latest_subscriber<_T> *subscribe_latest(const std::string &topic_name)
+        {
+            if (!claim_type<_T>(resolve(topic_name)))
+            {
+                return nullptr;
+            }
+            return add_subscriber(new latest_subscriber<_T>(topic_name));
+        }
+
+        template <class _T>
+        inline latest_subscriber<_T> *subscribe_latest(const Topic<_T> &topic)
+        {
+            if (bind(topic) == nullptr)
+            {
+                return nullptr;
+            }
+            return add_subscriber(new latest_subscriber<_T>(topic.name));
+        }
+
+        // once it returns true, no publisher touches the subscriber any more.
+        // for an executor driven subscriber it also waits for its running callbacks,
+        // so it must not be called from the subscriber's own callback.
+        inline bool unsubscribe(subscriber_base *_subscriber)
         {
             // Time Complexity: O(n)
             // This can be optimized by using tree, but this function is seldom called.
+            topic_entry *entry = resolve(_subscriber->topic());
             std::lock_guard<std::mutex> glock(mtx_subscribers);
-            auto &_subers = subscribers[_subscriber->topic_name];
-            decltype(_subers.begin()) to_del = _subers.end();
-            for (auto i = _subers.begin(); i != _subers.end(); i++)
+            auto next = new topic_entry::subscriber_list(*entry->subscribers.load());
+            decltype(next->begin()) to_del = next->end();
+            for (auto i = next->begin(); i != next->end(); i++)
             {
                 if ((*i) == _subscriber)
                 {
@@ -111,24 +772,209 @@ namespace stone
                     break;
                 }
             }
-            if (to_del != _subers.end())
+            if (to_del != next->end())
             {
-                _subers.erase(to_del);
+                next->erase(to_del);
+                entry->replace(next);
+                while (!_subscriber->idle())
+                {
+                    std::this_thread::yield();
+                }
                 return true;
             }
             else
             {
+                delete next;
                 return false;
             }
         }
 
+        // fixes the message type of a topic nobody used yet, returns false if the topic
+        // carries another message type
+        template <class _T>
+        bool declare(const std::string &topic_name)
+        {
+            return claim_type<_T>(resolve(topic_name));
+        }
+
+        // registers a subscriber of any kind, e.g. the awaitable_subscriber of coroutine.hpp.
+        // _S::message_type is the type its deliver() takes. returns nullptr if the topic
+        // carries another message type, s is not registered then and stays with the caller.
+        template <class _S>
+        _S *add_subscriber(_S *s)
+        {
+            topic_entry *entry = resolve(s->topic());
+            if (!claim_type<typename _S::message_type>(entry))
+            {
+                return nullptr;
+            }
+            std::lock_guard<std::mutex> glock(mtx_subscribers);
+            insert(entry, s);
+            return s;
+        }
+
     private:
+        template <class _T>
+        inline topic_handle<_T> advertise_entry(topic_entry *entry, std::size_t pool_size,
+                                                typename message_pool<_T>::ExhaustedPolicy policy)
+        {
+            if (!claim_type<_T>(entry))
+            {
+                return topic_handle<_T>();
+            }
+            std::lock_guard<std::mutex> glock(mtx_subscribers);
+            if (!entry->pool && pool_size > 0)
+            {
+                entry->pool = std::make_shared<message_pool<_T>>(pool_size, policy);
+            }
+            return topic_handle<_T>(entry, static_cast<message_pool<_T> *>(entry->pool.get()));
+        }
+
+        template <class _T>
+        inline void publish_entry(topic_entry *entry, const std::shared_ptr<_T> &msg)
+        {
+            // topics are never removed, so the name outlives any trace dump
+            STONE_TRACE_INSTANT("publish", entry->name.c_str(), 0);
+            entry->for_each([&msg](subscriber_base *s)
+                            { s->deliver(&msg); });
+        }
+
+        // the first typed use decides the message type of a topic, returns false for another one
+        template <class _T>
+        bool claim_type(topic_entry *entry)
+        {
+            // a load first, publishers of a typed topic do not write the shared line
+            const void *type = entry->type.load(std::memory_order_acquire);
+            if (type == nullptr && entry->type.compare_exchange_strong(type, &topic_type_tag<_T>))
+            {
+                return true;
+            }
+            return type == &topic_type_tag<_T>;
+        }
+
+        // the entry of a compile-time topic. the first use resolves the name and fills the slot,
+        // later ones only load it and compare the name pointer and the message type. returns
+        // nullptr if another declaration bound the id to another name or message type.
+        template <class _T>
+        topic_entry *bind(const Topic<_T> &topic)
+        {
+            if (topic.id >= DATAFLY_STATIC_TOPICS)
+            {
+                return nullptr;
+            }
+            static_slot &slot = static_topics[topic.id];
+            topic_entry *entry = slot.entry.load(std::memory_order_acquire);
+            if (entry == nullptr)
+            {
+                topic_entry *resolved = resolve(topic.name);
+                if (!claim_type<_T>(resolved))
+                {
+                    return nullptr;
+                }
+                std::lock_guard<std::mutex> glock(mtx_subscribers);
+                entry = slot.entry.load(std::memory_order_relaxed);
+                if (entry == nullptr)
+                {
+                    slot.name.store(topic.name, std::memory_order_relaxed);
+                    slot.entry.store(resolved, std::memory_order_release);
+                    entry = resolved;
+                }
+            }
+            // the same declaration in another translation unit may have another name pointer
+            if (slot.name.load(std::memory_order_relaxed) != topic.name && entry->name != topic.name)
+            {
+                return nullptr;
+            }
+            return entry->type.load(std::memory_order_relaxed) == &topic_type_tag<_T> ? entry : nullptr;
+        }
+
+        // the caller holds mtx_subscribers
+        void insert(topic_entry *entry, subscriber_base *s)
+        {
+            auto next = new topic_entry::subscriber_list(*entry->subscribers.load());
+            next->push_back(s);
+            entry->replace(next);
+        }
+
+        // POSIX shared memory names are one path component
+        static std::string shm_name(const std::string &topic_name)
+        {
+            std::string name = "/stone.";
+            for (char c : topic_name)
+            {
+                name += c == '/' ? '.' : c;
+            }
+            return name;
+        }
+
+        // topics are never removed, so an entry stays valid as long as the master.
+        topic_entry *resolve(const std::string &topic_name)
+        {
+            {
+                std::shared_lock<std::shared_mutex> slock(mtx_topics);
+                auto i = topics.find(topic_name);
+                if (i != topics.end())
+                {
+                    return i->second.get();
+                }
+            }
+            std::lock_guard<std::shared_mutex> glock(mtx_topics);
+            auto &entry = topics[topic_name];
+            if (!entry)
+            {
+                entry = std::make_unique<topic_entry>(topic_name);
+            }
+            return entry.get();
+        }
+
+        // serializes writers of the subscriber lists
         std::mutex mtx_subscribers;
-        std::unordered_map<std::string, std::vector<generic_subscriber *>> subscribers;
+
+        std::shared_mutex mtx_topics;
+        std::unordered_map<std::string, std::unique_ptr<topic_entry>> topics;
+
+        // a compile-time topic id, bound on first use to an entry and the name of the
+        // declaration that used it
+        class static_slot
+        {
+        public:
+            std::atomic<topic_entry *> entry{nullptr};
+            std::atomic<const char *> name{nullptr};
+        };
+
+        static_slot static_topics[DATAFLY_STATIC_TOPICS];
     };
 
     extern DataFlyMaster master;
 
+    template <class _T>
+    inline topic_handle<_T> advertise(const std::string &topic_name, std::size_t pool_size = 0,
+                                      typename message_pool<_T>::ExhaustedPolicy policy =
+                                          message_pool<_T>::ExhaustedPolicy::RETURN_NULL)
+    {
+        return master.advertise<_T>(topic_name, pool_size, policy);
+    }
+
+    template <class _T>
+    inline topic_handle<_T> advertise(const Topic<_T> &topic, std::size_t pool_size = 0,
+                                      typename message_pool<_T>::ExhaustedPolicy policy =
+                                          message_pool<_T>::ExhaustedPolicy::RETURN_NULL)
+    {
+        return master.advertise(topic, pool_size, policy);
+    }
+
+    template <class _T>
+    inline void publish(const topic_handle<_T> &topic, const std::shared_ptr<_T> &msg)
+    {
+        master.publish(topic, msg);
+    }
+
+    template <class _T>
+    inline bool publish(const Topic<_T> &topic, const std::shared_ptr<_T> &msg)
+    {
+        return master.publish(topic, msg);
+    }
+
     template <class _T>
     inline void publish(const std::string &topic_name, const std::shared_ptr<_T> &msg)
     {
@@ -136,17 +982,70 @@ namespace stone
     }
 
     template <class _T>
-    inline subscriber<_T> *subscribe(const std::string &topic_name, topic_callback<_T> cb, std::size_t queue_size = 10)
+    inline subscriber<_T> *subscribe(const std::string &topic_name, topic_callback<_T> cb, std::size_t queue_size = 10,
+                                     bool single_publisher = false)
+    {
+        return master.subscribe(topic_name, cb, queue_size, single_publisher);
+    }
+
+    template <class _T>
+    inline subscriber<_T> *subscribe(const std::string &topic_name, topic_callback<_T> cb,
+                                     const executor_options &options, std::size_t queue_size = 10,
+                                     bool single_publisher = false)
     {
-        return master.subscribe(topic_name, cb, queue_size);
+        return master.subscribe(topic_name, cb, options, queue_size, single_publisher);
     }
 
     template <class _T>
-    inline bool unsubscribe(subscriber<_T> *_subscriber)
+    inline subscriber<_T> *subscribe(const Topic<_T> &topic, topic_callback<typename Topic<_T>::message_type> cb,
+                                     std::size_t queue_size = 10, bool single_publisher = false)
+    {
+        return master.subscribe(topic, cb, queue_size, single_publisher);
+    }
+
+    template <class _T>
+    inline subscriber<_T> *subscribe(const Topic<_T> &topic, topic_callback<typename Topic<_T>::message_type> cb,
+                                     const executor_options &options, std::size_t queue_size = 10,
+                                     bool single_publisher = false)
+    {
+        return master.subscribe(topic, cb, options, queue_size, single_publisher);
+    }
+
+    template <class _T>
+    inline subscriber<_T> *subscribe(const std::string &topic_name, topic_callback<_T> cb,
+                                     Transport transport, std::size_t queue_size = 10)
+    {
+        return master.subscribe(topic_name, cb, transport, queue_size);
+    }
+
+    template <class _T>
+    inline bool share(const std::string &topic_name, std::size_t capacity = 64)
+    {
+        return master.share<_T>(topic_name, capacity);
+    }
+
+    inline bool unlink_shared(const std::string &topic_name)
+    {
+        return master.unlink_shared(topic_name);
+    }
+
+    template <class _T>
+    inline latest_subscriber<_T> *subscribe_latest(const std::string &topic_name)
+    {
+        return master.subscribe_latest<_T>(topic_name);
+    }
+
+    template <class _T>
+    inline latest_subscriber<_T> *subscribe_latest(const Topic<_T> &topic)
+    {
+        return master.subscribe_latest(topic);
+    }
+
+    inline bool unsubscribe(subscriber_base *_subscriber)
     {
         return master.unsubscribe(_subscriber);
     }
 
 } // namespace psl
 
-#endif
\ No newline at end of file
+#endif
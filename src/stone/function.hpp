@@ -0,0 +1,169 @@
+#ifndef STONE_FUNCTION_HPP
+#define STONE_FUNCTION_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "stoneconfig.hpp"
+
+namespace stone
+{
+    template <class Sig, std::size_t Capacity = TASK_FUNCTION_INLINE_SIZE>
+    class small_function;
+
+    // Move-only replacement for std::function.
+    // Callables up to Capacity bytes that can be moved without throwing are stored inline,
+    // so binding a lambda with a small capture does not allocate. Larger ones go to the heap.
+    template <class R, class... Args, std::size_t Capacity>
+    class small_function<R(Args...), Capacity>
+    {
+    private:
+        class Ops
+        {
+        public:
+            R (*invoke)(void *storage, Args &&...args);
+            // moves the callable from src to dst and destroys src
+            void (*relocate)(void *dst, void *src);
+            void (*destroy)(void *storage);
+        };
+
+        template <class F>
+        static constexpr bool stored_inline = sizeof(F) <= Capacity &&
+                                              alignof(F) <= alignof(std::max_align_t) &&
+                                              std::is_nothrow_move_constructible<F>::value;
+
+        template <class F>
+        class InlineOps
+        {
+        public:
+            static R invoke(void *storage, Args &&...args)
+            {
+                return (*static_cast<F *>(storage))(std::forward<Args>(args)...);
+            }
+            static void relocate(void *dst, void *src)
+            {
+                new (dst) F(std::move(*static_cast<F *>(src)));
+                static_cast<F *>(src)->~F();
+            }
+            static void destroy(void *storage)
+            {
+                static_cast<F *>(storage)->~F();
+            }
+            static constexpr Ops ops = {invoke, relocate, destroy};
+        };
+
+        template <class F>
+        class HeapOps
+        {
+        public:
+            static R invoke(void *storage, Args &&...args)
+            {
+                return (**static_cast<F **>(storage))(std::forward<Args>(args)...);
+            }
+            static void relocate(void *dst, void *src)
+            {
+                *static_cast<F **>(dst) = *static_cast<F **>(src);
+            }
+            static void destroy(void *storage)
+            {
+                delete *static_cast<F **>(storage);
+            }
+            static constexpr Ops ops = {invoke, relocate, destroy};
+        };
+
+        alignas(std::max_align_t) unsigned char storage[Capacity < sizeof(void *) ? sizeof(void *) : Capacity];
+        const Ops *ops = nullptr;
+
+    public:
+        small_function() {}
+        small_function(std::nullptr_t) {}
+
+        template <class F,
+                  class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, small_function>::value &&
+                                                  !std::is_same<typename std::decay<F>::type, std::nullptr_t>::value>::type>
+        small_function(F &&f)
+        {
+            using Fn = typename std::decay<F>::type;
+            if constexpr (stored_inline<Fn>)
+            {
+                new (storage) Fn(std::forward<F>(f));
+                ops = &InlineOps<Fn>::ops;
+            }
+            else
+            {
+                *reinterpret_cast<Fn **>(storage) = new Fn(std::forward<F>(f));
+                ops = &HeapOps<Fn>::ops;
+            }
+        }
+
+        small_function(small_function &&other) noexcept
+        {
+            if (other.ops != nullptr)
+            {
+                other.ops->relocate(storage, other.storage);
+                ops = other.ops;
+                other.ops = nullptr;
+            }
+        }
+
+        small_function &operator=(small_function &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                if (other.ops != nullptr)
+                {
+                    other.ops->relocate(storage, other.storage);
+                    ops = other.ops;
+                    other.ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        small_function &operator=(std::nullptr_t)
+        {
+            reset();
+            return *this;
+        }
+
+        template <class F,
+                  class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, small_function>::value &&
+                                                  !std::is_same<typename std::decay<F>::type, std::nullptr_t>::value>::type>
+        small_function &operator=(F &&f)
+        {
+            return *this = small_function(std::forward<F>(f));
+        }
+
+        small_function(const small_function &) = delete;
+        small_function &operator=(const small_function &) = delete;
+
+        ~small_function()
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            if (ops != nullptr)
+            {
+                ops->destroy(storage);
+                ops = nullptr;
+            }
+        }
+
+        explicit operator bool() const
+        {
+            return ops != nullptr;
+        }
+
+        R operator()(Args... args) const
+        {
+            return ops->invoke(const_cast<unsigned char *>(storage), std::forward<Args>(args)...);
+        }
+    };
+} // namespace stone
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef STONE_HISTOGRAM_HPP
+#define STONE_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace stone
+{
+    // Lock-free log-linear histogram of nanosecond values, in the spirit of HdrHistogram.
+    // Values below 2^SUB_BITS are counted exactly, above that every power of two is split
+    // into 2^(SUB_BITS-1) buckets, so a bucket is at most ~6% wide. Recording is a few
+    // relaxed atomic operations, snapshots can be taken while other threads record.
+    class LatencyHistogram
+    {
+    public:
+        static constexpr unsigned SUB_BITS = 5;
+        static constexpr std::size_t SUB_COUNT = std::size_t(1) << SUB_BITS;
+        static constexpr std::size_t HALF_COUNT = SUB_COUNT / 2;
+        static constexpr std::size_t BUCKET_COUNT = (64 - SUB_BITS + 1) * HALF_COUNT + HALF_COUNT;
+
+        class Snapshot
+        {
+        public:
+            uint64_t count = 0;
+            uint64_t min = 0;
+            uint64_t max = 0;
+            uint64_t sum = 0;
+            std::vector<uint64_t> buckets;
+
+            double mean() const
+            {
+                return count ? double(sum) / count : 0.0;
+            }
+
+            // upper bound of the bucket holding the p-th percentile, p in [0, 100]
+            uint64_t percentile(double p) const
+            {
+                if (count == 0)
+                {
+                    return 0;
+                }
+                uint64_t rank = static_cast<uint64_t>(p / 100.0 * count + 0.5);
+                rank = rank == 0 ? 1 : (rank > count ? count : rank);
+                uint64_t seen = 0;
+                for (std::size_t i = 0; i < buckets.size(); i++)
+                {
+                    seen += buckets[i];
+                    if (seen >= rank)
+                    {
+                        uint64_t upper = bucket_upper(i);
+                        return upper < max ? upper : max;
+                    }
+                }
+                return max;
+            }
+        };
+
+        LatencyHistogram()
+        {
+            reset();
+        }
+
+        ~LatencyHistogram() {}
+
+        LatencyHistogram(const LatencyHistogram &) = delete;
+        LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+        static std::size_t bucket_of(uint64_t value)
+        {
+            if (value < SUB_COUNT)
+            {
+                return static_cast<std::size_t>(value);
+            }
+            unsigned shift = msb(value) - SUB_BITS + 1;
+            return shift * HALF_COUNT + static_cast<std::size_t>(value >> shift);
+        }
+
+        static uint64_t bucket_lower(std::size_t index)
+        {
+            if (index < SUB_COUNT)
+            {
+                return index;
+            }
+            unsigned shift = static_cast<unsigned>(index / HALF_COUNT - 1);
+            return uint64_t(index - shift * HALF_COUNT) << shift;
+        }
+
+        static uint64_t bucket_upper(std::size_t index)
+        {
+            if (index + 1 >= BUCKET_COUNT)
+            {
+                return UINT64_MAX;
+            }
+            return bucket_lower(index + 1) - 1;
+        }
+
+        void record(uint64_t value)
+        {
+            buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+            total.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+            uint64_t current = min_value.load(std::memory_order_relaxed);
+            while (value < current && !min_value.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            {
+            }
+            current = max_value.load(std::memory_order_relaxed);
+            while (value > current && !max_value.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        Snapshot snapshot() const
+        {
+            Snapshot s;
+            s.buckets.resize(BUCKET_COUNT);
+            for (std::size_t i = 0; i < BUCKET_COUNT; i++)
+            {
+                s.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+                s.count += s.buckets[i];
+            }
+            s.sum = sum.load(std::memory_order_relaxed);
+            s.min = s.count ? min_value.load(std::memory_order_relaxed) : 0;
+            s.max = max_value.load(std::memory_order_relaxed);
+            return s;
+        }
+
+        uint64_t count() const
+        {
+            return total.load(std::memory_order_relaxed);
+        }
+
+        void reset()
+        {
+            for (auto &&b : buckets)
+            {
+                b.store(0, std::memory_order_relaxed);
+            }
+            total.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+            min_value.store(UINT64_MAX, std::memory_order_relaxed);
+            max_value.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        static unsigned msb(uint64_t value)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return 63 - __builtin_clzll(value);
+#else
+            unsigned n = 0;
+            while (value >>= 1)
+            {
+                n++;
+            }
+            return n;
+#endif
+        }
+
+        std::atomic<uint64_t> buckets[BUCKET_COUNT];
+        std::atomic<uint64_t> total;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> min_value;
+        std::atomic<uint64_t> max_value;
+    };
+
+    // Timing of one task, see WorkItem::enable_stats.
+    class TaskStats
+    {
+    public:
+        // how late a timed or interval task was handed to the pool, relative to its wakeup time
+        LatencyHistogram lateness;
+        // time between being pushed to the pool and starting to run
+        LatencyHistogram queued;
+        // run time of the task function
+        LatencyHistogram execution;
+    };
+} // namespace stone
+
+#endif
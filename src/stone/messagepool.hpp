@@ -0,0 +1,136 @@
+#ifndef STONE_MESSAGEPOOL_HPP
+#define STONE_MESSAGEPOOL_HPP
+
+#include <atomic>
+#include <memory>
+
+namespace stone
+{
+    // Fixed pool of preallocated messages.
+    // loan() hands out a slot that is not referenced by anybody else. The slot returns to the
+    // pool by itself once the last subscriber drops its shared_ptr, the pool only has to look at
+    // the use count, so neither loaning nor returning allocates.
+    template <class _T>
+    class message_pool
+    {
+    public:
+        enum class ExhaustedPolicy
+        {
+            // loan() returns nullptr
+            RETURN_NULL,
+            // loan() falls back to make_shared
+            ALLOCATE,
+        };
+
+        class Stats
+        {
+        public:
+            std::size_t capacity = 0;
+            std::size_t in_use = 0;
+            std::size_t loans = 0;
+            // loans that found every slot in use
+            std::size_t exhausted = 0;
+        };
+
+    private:
+        class Slot
+        {
+        public:
+            // guards the check-and-copy of value against other loaners
+            std::atomic_flag claimed = ATOMIC_FLAG_INIT;
+            std::shared_ptr<_T> value;
+        };
+
+        std::size_t slot_count;
+        std::unique_ptr<Slot[]> slots;
+        ExhaustedPolicy policy;
+
+        std::atomic<std::size_t> cursor{0};
+        std::atomic<std::size_t> loans{0};
+        std::atomic<std::size_t> exhausted{0};
+
+        bool try_loan(Slot &slot, std::shared_ptr<_T> &msg)
+        {
+            if (slot.claimed.test_and_set(std::memory_order_acquire))
+            {
+                return false;
+            }
+            bool free = slot.value.use_count() == 1;
+            if (free)
+            {
+                // pairs with the release of the last reference held outside the pool
+                std::atomic_thread_fence(std::memory_order_acquire);
+                msg = slot.value;
+            }
+            slot.claimed.clear(std::memory_order_release);
+            return free;
+        }
+
+    public:
+        message_pool(std::size_t size, ExhaustedPolicy policy = ExhaustedPolicy::RETURN_NULL)
+            : slot_count(size), slots(new Slot[size]), policy(policy)
+        {
+            for (std::size_t i = 0; i < slot_count; i++)
+            {
+                slots[i].value = std::make_shared<_T>();
+            }
+        }
+
+        ~message_pool() {}
+
+        message_pool(const message_pool &) = delete;
+        message_pool &operator=(const message_pool &) = delete;
+
+        // the message keeps the content of its previous use, the publisher fills it in place.
+        std::shared_ptr<_T> loan()
+        {
+            std::shared_ptr<_T> msg;
+            std::size_t start = cursor.fetch_add(1, std::memory_order_relaxed);
+            for (std::size_t i = 0; i < slot_count; i++)
+            {
+                if (try_loan(slots[(start + i) % slot_count], msg))
+                {
+                    loans.fetch_add(1, std::memory_order_relaxed);
+                    return msg;
+                }
+            }
+            exhausted.fetch_add(1, std::memory_order_relaxed);
+            if (policy == ExhaustedPolicy::ALLOCATE)
+            {
+                return std::make_shared<_T>();
+            }
+            return nullptr;
+        }
+
+        std::size_t capacity() const
+        {
+            return slot_count;
+        }
+
+        // O(n), meant for monitoring
+        std::size_t in_use() const
+        {
+            std::size_t count = 0;
+            for (std::size_t i = 0; i < slot_count; i++)
+            {
+                if (slots[i].value.use_count() > 1)
+                {
+                    count++;
+                }
+            }
+            return count;
+        }
+
+        Stats stats() const
+        {
+            Stats s;
+            s.capacity = slot_count;
+            s.in_use = in_use();
+            s.loans = loans.load(std::memory_order_relaxed);
+            s.exhausted = exhausted.load(std::memory_order_relaxed);
+            return s;
+        }
+    };
+} // namespace stone
+
+#endif
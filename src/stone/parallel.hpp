@@ -0,0 +1,222 @@
+#ifndef STONE_PARALLEL_HPP
+#define STONE_PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "scheduler.hpp"
+
+namespace stone
+{
+    // One parallel_for or parallel_reduce call. The range is handed out in chunks that start
+    // large and shrink as it runs out, but never below the grain: every participant takes
+    // remaining / (2 * participants) elements at a time, so the last chunks are small and
+    // the participants finish together.
+    // The caller takes chunks like the workers do, then only waits for chunks other threads
+    // are running. A helper that gets to run after the range is gone returns right away, the
+    // caller never waits for queued helpers, so a call from inside a worker cannot deadlock
+    // even if every other worker is blocked.
+    class ParallelLoop
+    {
+    public:
+        // body(context, participant, begin, end)
+        using body_fn = void (*)(void *, std::size_t, std::size_t, std::size_t);
+
+        ParallelLoop(std::size_t first, std::size_t last, std::size_t grain, std::size_t participants,
+                     body_fn body, void *context)
+            : next(first), last(last), total(last - first), grain(grain), participants(participants),
+              body(body), context(context)
+        {
+        }
+
+        // runs chunks on the calling thread until the range is gone
+        void run()
+        {
+            std::size_t participant = joined.fetch_add(1, std::memory_order_relaxed);
+            std::size_t begin, end;
+            while (claim(begin, end))
+            {
+                // the context may be gone once the range is done, it is only used for a claimed chunk
+                try
+                {
+                    body(context, participant, begin, end);
+                }
+                catch (...)
+                {
+                    fail(std::current_exception());
+                }
+                finish(end - begin);
+            }
+        }
+
+        // blocks until every claimed chunk is done, rethrows the first exception of the body
+        void wait()
+        {
+            std::unique_lock<std::mutex> ulock(done_mtx);
+            done_cv.wait(ulock, [this]
+                         { return done.load(std::memory_order_acquire) == total; });
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+
+    private:
+        bool claim(std::size_t &begin, std::size_t &end)
+        {
+            std::size_t current = next.load(std::memory_order_relaxed);
+            while (current < last)
+            {
+                std::size_t size = std::min(last - current, std::max(grain, (last - current) / (2 * participants)));
+                if (next.compare_exchange_weak(current, current + size, std::memory_order_relaxed))
+                {
+                    begin = current;
+                    end = current + size;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void finish(std::size_t count)
+        {
+            if (done.fetch_add(count, std::memory_order_acq_rel) + count == total)
+            {
+                // notify under the lock, so a caller between its check and its wait cannot miss it
+                std::lock_guard<std::mutex> glock(done_mtx);
+                done_cv.notify_all();
+            }
+        }
+
+        // keeps the first exception and drops the chunks nobody claimed yet
+        void fail(std::exception_ptr e)
+        {
+            {
+                std::lock_guard<std::mutex> glock(done_mtx);
+                if (!error)
+                {
+                    error = e;
+                }
+            }
+            std::size_t current = next.exchange(last, std::memory_order_relaxed);
+            if (current < last)
+            {
+                finish(last - current);
+            }
+        }
+
+        std::atomic<std::size_t> next;
+        const std::size_t last;
+        const std::size_t total;
+        const std::size_t grain;
+        const std::size_t participants;
+        body_fn body;
+        void *context;
+
+        std::atomic<std::size_t> joined{0};
+        std::atomic<std::size_t> done{0};
+        std::mutex done_mtx;
+        std::condition_variable done_cv;
+        std::exception_ptr error;
+    };
+
+    // runs fn(begin, end) over [first, last) split into chunks of at least grain elements.
+    // the calling thread takes part and the call returns when every element is done.
+    // an exception thrown by fn skips the chunks not started yet and is rethrown here.
+    template <class F>
+    void parallel_for(std::size_t first, std::size_t last, std::size_t grain, F &&fn,
+                      ThreadPool *pool = &defaultPool)
+    {
+        if (first >= last)
+        {
+            return;
+        }
+        grain = std::max<std::size_t>(grain, 1);
+        std::size_t chunks = (last - first + grain - 1) / grain;
+        std::size_t helpers = std::min(pool->size(), chunks - 1);
+        if (helpers == 0)
+        {
+            fn(first, last);
+            return;
+        }
+        using function_type = typename std::remove_reference<F>::type;
+        function_type *function = &fn;
+        auto body = [](void *context, std::size_t, std::size_t begin, std::size_t end)
+        {
+            (**static_cast<function_type **>(context))(begin, end);
+        };
+        // shared with the helpers, which may run long after this call returned
+        auto loop = std::make_shared<ParallelLoop>(first, last, grain, helpers + 1, body, &function);
+        for (std::size_t i = 0; i < helpers; i++)
+        {
+            pool->submit([loop]()
+                         { loop->run(); });
+        }
+        loop->run();
+        loop->wait();
+    }
+
+    // folds [first, last) into one value. every participant starts from identity and folds
+    // its chunks with acc = fn(begin, end, acc), the partial results are combined with
+    // reduce(a, b) in a fixed participant order. which chunks a participant gets depends on
+    // timing, so reduce must be associative and commutative.
+    template <class _T, class F, class R>
+    _T parallel_reduce(std::size_t first, std::size_t last, std::size_t grain, const _T &identity,
+                       F &&fn, R &&reduce, ThreadPool *pool = &defaultPool)
+    {
+        if (first >= last)
+        {
+            return identity;
+        }
+        grain = std::max<std::size_t>(grain, 1);
+        std::size_t chunks = (last - first + grain - 1) / grain;
+        std::size_t helpers = std::min(pool->size(), chunks - 1);
+        if (helpers == 0)
+        {
+            return fn(first, last, identity);
+        }
+
+        // one cache line per participant, they are written after every chunk
+        class alignas(64) Partial
+        {
+        public:
+            _T value;
+        };
+        class Context
+        {
+        public:
+            typename std::remove_reference<F>::type *fn;
+            std::vector<Partial> partials;
+        };
+        Context context{&fn, std::vector<Partial>(helpers + 1, Partial{identity})};
+        auto body = [](void *context, std::size_t participant, std::size_t begin, std::size_t end)
+        {
+            auto c = static_cast<Context *>(context);
+            _T &acc = c->partials[participant].value;
+            acc = (*c->fn)(begin, end, std::move(acc));
+        };
+        auto loop = std::make_shared<ParallelLoop>(first, last, grain, helpers + 1, body, &context);
+        for (std::size_t i = 0; i < helpers; i++)
+        {
+            pool->submit([loop]()
+                         { loop->run(); });
+        }
+        loop->run();
+        loop->wait();
+        _T result = std::move(context.partials[0].value);
+        for (std::size_t i = 1; i < context.partials.size(); i++)
+        {
+            result = reduce(std::move(result), std::move(context.partials[i].value));
+        }
+        return result;
+    }
+} // namespace stone
+
+#endif
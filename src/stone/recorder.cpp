@@ -0,0 +1,362 @@
+#include "recorder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace stone
+{
+    static uint64_t log_now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static std::size_t record_bytes(std::size_t size)
+    {
+        return sizeof(LogRecord) + (size + 7) / 8 * 8;
+    }
+
+    Recorder::Recorder(const std::string &directory, std::size_t segment_bytes, DataFlyMaster *master)
+        : master(master), directory(directory), segment_bytes(segment_bytes), queue(RECORDER_QUEUE_SIZE)
+    {
+    }
+
+    Recorder::~Recorder()
+    {
+        stop();
+    }
+
+    bool Recorder::start()
+    {
+        std::lock_guard<std::mutex> glock(mtx);
+        if (running)
+        {
+            return true;
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        if (segments == 0)
+        {
+            // a directory holds one log, drop the segments of an earlier one
+            for (auto &&f : std::filesystem::directory_iterator(directory, ec))
+            {
+                if (f.path().extension() == ".stlog")
+                {
+                    std::filesystem::remove(f.path(), ec);
+                }
+            }
+        }
+        if (!open_segment(0))
+        {
+            return false;
+        }
+        running = true;
+        writer = std::thread(&Recorder::writer_loop, this);
+        for (auto &&t : topics)
+        {
+            t.attach(master, t.subscriber.get());
+        }
+        return true;
+    }
+
+    void Recorder::stop()
+    {
+        {
+            std::lock_guard<std::mutex> glock(mtx);
+            if (!running)
+            {
+                return;
+            }
+            // once unsubscribe returns no publisher is inside enqueue any more,
+            // so the writer finds every message that made it into the queue
+            for (auto &&t : topics)
+            {
+                master->unsubscribe(t.subscriber.get());
+            }
+            running = false;
+        }
+        writer.join();
+        close_segment();
+    }
+
+    Recorder::Stats Recorder::stats() const
+    {
+        Stats s;
+        s.recorded = recorded.load();
+        s.dropped = dropped.load();
+        s.segments = segments.load();
+        s.bytes = bytes.load();
+        return s;
+    }
+
+    void Recorder::enqueue(std::shared_ptr<const void> msg, uint32_t topic)
+    {
+        Entry e;
+        e.msg = std::move(msg);
+        e.time_ns = log_now_ns();
+        e.topic = topic;
+        if (!queue.push(e))
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void Recorder::writer_loop()
+    {
+        while (true)
+        {
+            // read before draining, so nothing queued before stop() is left behind
+            bool stopping = !running.load();
+            std::size_t n = 0;
+            Entry e;
+            while (queue.pop(e))
+            {
+                write_message(e);
+                e.msg = nullptr;
+                n++;
+            }
+            if (stopping)
+            {
+                break;
+            }
+            if (n == 0)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(RECORDER_POLL_US));
+            }
+        }
+    }
+
+    bool Recorder::write_message(const Entry &e)
+    {
+        if (e.topic >= known.size())
+        {
+            std::lock_guard<std::mutex> glock(mtx);
+            for (std::size_t i = known.size(); i < topics.size(); i++)
+            {
+                known.push_back({topics[i].name, topics[i].msg_size});
+            }
+        }
+        const std::string &name = known[e.topic].first;
+        std::size_t size = known[e.topic].second;
+        std::size_t definition = record_bytes(sizeof(uint64_t) + name.size());
+        bool define = e.topic >= defined.size() || !defined[e.topic];
+        if (segment == nullptr || segment_used + record_bytes(size) + (define ? definition : 0) > segment_size)
+        {
+            close_segment();
+            if (!open_segment(record_bytes(size) + definition))
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            define = true;
+        }
+        if (define)
+        {
+            std::string payload(sizeof(uint64_t), '\0');
+            uint64_t msg_size = size;
+            std::memcpy(&payload[0], &msg_size, sizeof(msg_size));
+            payload += name;
+            write_record(e.time_ns, e.topic | LOG_DEFINE, payload.data(), payload.size());
+            if (defined.size() <= e.topic)
+            {
+                defined.resize(e.topic + 1, false);
+            }
+            defined[e.topic] = true;
+        }
+        write_record(e.time_ns, e.topic, e.msg.get(), size);
+        recorded.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // the caller made sure the record fits into the segment
+    void Recorder::write_record(uint64_t time_ns, uint32_t topic, const void *data, std::size_t size)
+    {
+        LogRecord r;
+        r.time_ns = time_ns;
+        r.topic = topic;
+        r.size = uint32_t(size);
+        std::memcpy(segment + segment_used, &r, sizeof(r));
+        std::memcpy(segment + segment_used + sizeof(r), data, size);
+        // the padding is still zero from the new segment
+        segment_used += record_bytes(size);
+        bytes.fetch_add(record_bytes(size), std::memory_order_relaxed);
+    }
+
+    bool Recorder::open_segment(std::size_t min_bytes)
+    {
+#ifdef __linux__
+        char file[32];
+        snprintf(file, sizeof(file), "segment_%06zu.stlog", segments.load());
+        segment_path = directory + "/" + file;
+        std::size_t size = std::max(segment_bytes, sizeof(LogSegmentHeader) + min_bytes);
+        int fd = ::open(segment_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        void *p = MAP_FAILED;
+        if (ftruncate(fd, off_t(size)) == 0)
+        {
+            p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+        segment = static_cast<char *>(p);
+        segment_size = size;
+        LogSegmentHeader header;
+        header.magic = LOG_MAGIC;
+        header.version = LOG_VERSION;
+        std::memcpy(segment, &header, sizeof(header));
+        segment_used = sizeof(header);
+        defined.clear();
+        segments.fetch_add(1);
+        return true;
+#else
+        (void)min_bytes;
+        return false;
+#endif
+    }
+
+    // a segment that was never closed, e.g. after a crash, ends at its first zero record
+    void Recorder::close_segment()
+    {
+#ifdef __linux__
+        if (segment == nullptr)
+        {
+            return;
+        }
+        munmap(segment, segment_size);
+        segment = nullptr;
+        // if this fails, the rest of the segment stays zero filled and readers stop there as well
+        int rc = truncate(segment_path.c_str(), off_t(segment_used));
+        (void)rc;
+#endif
+    }
+
+    Replayer::Replayer(const std::string &directory, DataFlyMaster *master) : master(master), directory(directory) {}
+
+    std::size_t Replayer::play(double speed)
+    {
+        stopping = false;
+        std::size_t published = 0;
+#ifdef __linux__
+        std::vector<std::string> files;
+        std::error_code ec;
+        for (auto &&f : std::filesystem::directory_iterator(directory, ec))
+        {
+            if (f.path().extension() == ".stlog")
+            {
+                files.push_back(f.path().string());
+            }
+        }
+        std::sort(files.begin(), files.end());
+
+        bool first = true;
+        uint64_t base_ns = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (auto &&path : files)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                continue;
+            }
+            struct stat st;
+            void *p = MAP_FAILED;
+            std::size_t size = 0;
+            if (fstat(fd, &st) == 0 && std::size_t(st.st_size) >= sizeof(LogSegmentHeader))
+            {
+                size = std::size_t(st.st_size);
+                p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            close(fd);
+            if (p == MAP_FAILED)
+            {
+                continue;
+            }
+            const char *data = static_cast<const char *>(p);
+            LogSegmentHeader header;
+            std::memcpy(&header, data, sizeof(header));
+            // recorded topic id -> index into publishers, defined again by every segment
+            std::vector<int> ids;
+            std::size_t pos = sizeof(header);
+            while (header.magic == LOG_MAGIC && header.version == LOG_VERSION && !stopping &&
+                   pos + sizeof(LogRecord) <= size)
+            {
+                LogRecord r;
+                std::memcpy(&r, data + pos, sizeof(r));
+                if (r.size == 0 || pos + sizeof(r) + r.size > size)
+                {
+                    break;
+                }
+                const char *payload = data + pos + sizeof(r);
+                pos += record_bytes(r.size);
+                if (r.topic & LOG_DEFINE)
+                {
+                    uint32_t id = r.topic & ~LOG_DEFINE;
+                    uint64_t msg_size = 0;
+                    if (r.size < sizeof(msg_size))
+                    {
+                        continue;
+                    }
+                    std::memcpy(&msg_size, payload, sizeof(msg_size));
+                    std::string name(payload + sizeof(msg_size), r.size - sizeof(msg_size));
+                    if (ids.size() <= id)
+                    {
+                        ids.resize(id + 1, -1);
+                    }
+                    ids[id] = -1;
+                    for (std::size_t i = 0; i < publishers.size(); i++)
+                    {
+                        if (publishers[i].name == name && publishers[i].msg_size == msg_size)
+                        {
+                            ids[id] = int(i);
+                        }
+                    }
+                    continue;
+                }
+                if (r.topic >= ids.size() || ids[r.topic] < 0)
+                {
+                    continue;
+                }
+                if (speed > 0)
+                {
+                    if (first)
+                    {
+                        base_ns = r.time_ns;
+                        first = false;
+                    }
+                    // records are stamped before they are queued, one may be older than the first
+                    int64_t offset_ns = std::max<int64_t>(int64_t(r.time_ns - base_ns), 0);
+                    auto due = start + std::chrono::nanoseconds(int64_t(offset_ns / speed));
+                    // short sleeps, so stop() does not wait for a long gap in the log
+                    while (!stopping && std::chrono::steady_clock::now() < due)
+                    {
+                        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                            due - std::chrono::steady_clock::now(), std::chrono::milliseconds(10)));
+                    }
+                }
+                publishers[ids[r.topic]].publish(payload);
+                published++;
+            }
+            munmap(p, size);
+        }
+#else
+        (void)speed;
+#endif
+        return published;
+    }
+} // namespace stone
@@ -0,0 +1,243 @@
+#ifndef STONE_RECORDER_HPP
+#define STONE_RECORDER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "stoneconfig.hpp"
+#include "datafly.hpp"
+
+namespace stone
+{
+    // On-disk record of a topic log. A log is a directory of segment files, each one starts with
+    // a LogSegmentHeader and holds records back to back, every record padded to 8 bytes.
+    // A record with size 0 ends the segment. Records with LOG_DEFINE set in topic define the
+    // topic id below the flag: the payload is the message size as uint64_t, then the topic name.
+    // Every segment repeats the definitions it uses, so each one can be read on its own.
+    class LogRecord
+    {
+    public:
+        // steady clock of the recording host
+        uint64_t time_ns;
+        uint32_t topic;
+        uint32_t size;
+    };
+
+    class LogSegmentHeader
+    {
+    public:
+        uint64_t magic;
+        uint64_t version;
+    };
+
+    constexpr uint64_t LOG_MAGIC = 0x73746f6e656c6f67; // "stonelog"
+    constexpr uint64_t LOG_VERSION = 1;
+    constexpr uint32_t LOG_DEFINE = 0x80000000;
+
+    // Records every message of the selected topics into a segmented, memory-mapped log.
+    // The publisher only pushes a reference to the message into a lock-free ring and never
+    // waits, a message that finds the ring full is dropped and counted. A background thread
+    // copies the messages into the mapped segment and starts a new one every segment_bytes.
+    // A recorded message stays referenced until it is written, loaned messages return to
+    // their pool a little later.
+    class Recorder
+    {
+    public:
+        class Stats
+        {
+        public:
+            std::size_t recorded = 0;
+            // messages that found the queue full
+            std::size_t dropped = 0;
+            std::size_t segments = 0;
+            std::size_t bytes = 0;
+        };
+
+        // the directory is created if needed. it holds one log, starting the recorder
+        // removes the segments of an earlier log in it.
+        Recorder(const std::string &directory, std::size_t segment_bytes = RECORDER_SEGMENT_BYTES,
+                 DataFlyMaster *master = &stone::master);
+        ~Recorder();
+
+        Recorder(const Recorder &) = delete;
+        Recorder &operator=(const Recorder &) = delete;
+
+        // adds a topic, before or while recording.
+        // returns false if the topic carries another message type.
+        template <class _T>
+        bool record(const std::string &topic_name)
+        {
+            static_assert(std::is_trivially_copyable<_T>::value, "recorded topics need a trivially copyable message type");
+            if (!master->declare<_T>(topic_name))
+            {
+                return false;
+            }
+            std::lock_guard<std::mutex> glock(mtx);
+            uint32_t id = uint32_t(topics.size());
+            auto attach = [](DataFlyMaster *m, subscriber_base *s)
+            {
+                m->add_subscriber(static_cast<tap<_T> *>(s));
+            };
+            topics.push_back(Topic{topic_name, sizeof(_T), std::make_unique<tap<_T>>(topic_name, this, id), attach});
+            // taps are only subscribed while recording
+            if (running)
+            {
+                attach(master, topics.back().subscriber.get());
+            }
+            return true;
+        }
+
+        // starts the writer thread and subscribes to the topics.
+        // returns false if the first segment cannot be created.
+        bool start();
+
+        // stops recording, writes what is still queued and closes the last segment.
+        void stop();
+
+        Stats stats() const;
+
+    private:
+        class Entry
+        {
+        public:
+            std::shared_ptr<const void> msg;
+            uint64_t time_ns = 0;
+            uint32_t topic = 0;
+        };
+
+        class Topic
+        {
+        public:
+            std::string name;
+            std::size_t msg_size;
+            std::unique_ptr<subscriber_base> subscriber;
+            // subscribes the tap with its message type
+            void (*attach)(DataFlyMaster *, subscriber_base *);
+        };
+
+        template <class _T>
+        class tap : public subscriber_base
+        {
+        public:
+            using message_type = _T;
+
+            tap(const std::string &topic_name, Recorder *owner, uint32_t id) : owner(owner), id(id)
+            {
+                this->topic_name = topic_name;
+            }
+
+        private:
+            void deliver(const void *msg) override
+            {
+                auto &ptr = *static_cast<const std::shared_ptr<_T> *>(msg);
+                if (ptr)
+                {
+                    owner->enqueue(ptr, id);
+                }
+            }
+
+            Recorder *owner;
+            uint32_t id;
+        };
+
+        void enqueue(std::shared_ptr<const void> msg, uint32_t topic);
+        void writer_loop();
+        void write_record(uint64_t time_ns, uint32_t topic, const void *data, std::size_t size);
+        bool write_message(const Entry &e);
+        bool open_segment(std::size_t min_bytes);
+        void close_segment();
+
+        DataFlyMaster *master;
+        std::string directory;
+        std::size_t segment_bytes;
+
+        std::mutex mtx;
+        std::vector<Topic> topics;
+
+        BoundedRing<Entry> queue;
+        std::thread writer;
+        std::atomic<bool> running{false};
+
+        // owned by the writer thread while it runs
+        char *segment = nullptr;
+        std::size_t segment_size = 0;
+        std::size_t segment_used = 0;
+        std::string segment_path;
+        // name and message size of every topic the writer has seen
+        std::vector<std::pair<std::string, std::size_t>> known;
+        // topics defined in the current segment
+        std::vector<bool> defined;
+
+        std::atomic<std::size_t> recorded{0};
+        std::atomic<std::size_t> dropped{0};
+        std::atomic<std::size_t> segments{0};
+        std::atomic<std::size_t> bytes{0};
+    };
+
+    // Publishes a recorded log again, in the recorded order and with the recorded spacing.
+    // Only topics registered with replay<_T>() are published, every message is copied into a
+    // message loaned from the topic (see advertise) or allocated.
+    class Replayer
+    {
+    public:
+        explicit Replayer(const std::string &directory, DataFlyMaster *master = &stone::master);
+        ~Replayer() {}
+
+        template <class _T>
+        void replay(const std::string &topic_name)
+        {
+            static_assert(std::is_trivially_copyable<_T>::value, "replayed topics need a trivially copyable message type");
+            auto handle = master->advertise<_T>(topic_name);
+            if (!handle.valid())
+            {
+                // the topic carries another message type, its records are skipped
+                return;
+            }
+            DataFlyMaster *m = master;
+            publishers.push_back(Publisher{topic_name, sizeof(_T), [handle, m](const void *data)
+                                           {
+                                               auto msg = handle.loan();
+                                               if (msg == nullptr)
+                                               {
+                                                   msg = std::make_shared<_T>();
+                                               }
+                                               std::memcpy(static_cast<void *>(msg.get()), data, sizeof(_T));
+                                               m->publish(handle, msg);
+                                           }});
+        }
+
+        // blocks until the log is played or stop() is called, returns the messages published.
+        // speed 2 plays twice as fast, speed 0 as fast as possible.
+        std::size_t play(double speed = 1.0);
+
+        // may be called from any thread
+        void stop()
+        {
+            stopping = true;
+        }
+
+    private:
+        class Publisher
+        {
+        public:
+            std::string name;
+            std::size_t msg_size;
+            std::function<void(const void *)> publish;
+        };
+
+        DataFlyMaster *master;
+        std::string directory;
+        std::vector<Publisher> publishers;
+        std::atomic<bool> stopping{false};
+    };
+} // namespace stone
+
+#endif
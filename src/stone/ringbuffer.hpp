@@ -0,0 +1,186 @@
+#ifndef STONE_RINGBUFFER_HPP
+#define STONE_RINGBUFFER_HPP
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+namespace stone
+{
+    // Bounded lock-free queue, all cells are allocated up front.
+    // Every cell carries a sequence number telling whether it is free for the producer
+    // of round n or filled for the consumer of round n, so neither side ever waits on the other.
+    // push() accepts any number of producers, push_single() is for one producer at a time.
+    // pop() accepts any number of consumers.
+    // The cells are rounded up to a power of two. The ring still holds at most capacity
+    // values, otherwise pushing also compares the position with head.
+    template <class _T>
+    class BoundedRing
+    {
+    private:
+        class Cell
+        {
+        public:
+            std::atomic<std::size_t> sequence;
+            _T value;
+        };
+
+        std::size_t bound;
+        std::size_t cell_count;
+        std::size_t cell_mask;
+        std::unique_ptr<Cell[]> cells;
+
+        // producers and consumers are kept on separate cache lines
+        alignas(64) std::atomic<std::size_t> tail{0};
+        alignas(64) std::atomic<std::size_t> head{0};
+
+        // true if a value at pos would exceed the capacity. head only grows, so a stale one
+        // can only make the ring look fuller than it is.
+        bool over_bound(std::size_t pos) const
+        {
+            return bound != cell_count && pos - head.load(std::memory_order_acquire) >= bound;
+        }
+
+        void commit(Cell &cell, std::size_t pos, const _T &value)
+        {
+            cell.value = value;
+            cell.sequence.store(pos + 1, std::memory_order_release);
+        }
+
+        static std::size_t round_up(std::size_t capacity)
+        {
+            std::size_t n = 1;
+            while (n < capacity)
+            {
+                n <<= 1;
+            }
+            return n;
+        }
+
+    public:
+        explicit BoundedRing(std::size_t capacity)
+            : bound(capacity),
+              cell_count(capacity == 0 ? 0 : round_up(capacity)),
+              cell_mask(round_up(capacity) - 1),
+              cells(new Cell[round_up(capacity)])
+        {
+            for (std::size_t i = 0; i < cell_count; i++)
+            {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        ~BoundedRing() {}
+
+        BoundedRing(const BoundedRing &) = delete;
+        BoundedRing &operator=(const BoundedRing &) = delete;
+
+        std::size_t capacity() const
+        {
+            return bound;
+        }
+
+        // approximate while producers or consumers are running
+        std::size_t size() const
+        {
+            std::size_t t = tail.load(std::memory_order_acquire);
+            std::size_t h = head.load(std::memory_order_acquire);
+            return t > h ? t - h : 0;
+        }
+
+        bool empty() const
+        {
+            return size() == 0;
+        }
+
+        // returns false when the ring is full.
+        bool push(const _T &value)
+        {
+            if (cell_count == 0)
+            {
+                return false;
+            }
+            std::size_t pos = tail.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Cell &cell = cells[pos & cell_mask];
+                std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (over_bound(pos))
+                    {
+                        return false;
+                    }
+                    if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        commit(cell, pos, value);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // same as push(), without the CAS. only one thread may push at a time.
+        bool push_single(const _T &value)
+        {
+            if (cell_count == 0)
+            {
+                return false;
+            }
+            std::size_t pos = tail.load(std::memory_order_relaxed);
+            Cell &cell = cells[pos & cell_mask];
+            if (cell.sequence.load(std::memory_order_acquire) != pos || over_bound(pos))
+            {
+                return false;
+            }
+            tail.store(pos + 1, std::memory_order_relaxed);
+            commit(cell, pos, value);
+            return true;
+        }
+
+        // returns false when the ring is empty.
+        bool pop(_T &value)
+        {
+            if (cell_count == 0)
+            {
+                return false;
+            }
+            std::size_t pos = head.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Cell &cell = cells[pos & cell_mask];
+                std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0)
+                {
+                    if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        // moving out also drops the reference the cell held
+                        value = std::move(cell.value);
+                        cell.sequence.store(pos + cell_count, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+    };
+} // namespace stone
+
+#endif
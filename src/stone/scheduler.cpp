@@ -4,4 +4,30 @@ namespace stone
 {
     ThreadPool defaultPool(THREAD_POOL_SIZE);
     Scheduler defaultScheduler(&defaultPool);
+
+    static std::mutex pools_mtx;
+    static std::unordered_map<std::string, std::unique_ptr<ThreadPool>> pools;
+
+    ThreadPool *createPool(const ThreadPool::Config &config)
+    {
+        std::lock_guard<std::mutex> glock(pools_mtx);
+        if (config.name == "default" || pools.count(config.name) != 0)
+        {
+            return nullptr;
+        }
+        auto &pool = pools[config.name];
+        pool = std::make_unique<ThreadPool>(config);
+        return pool.get();
+    }
+
+    ThreadPool *getPool(const std::string &name)
+    {
+        if (name == "default")
+        {
+            return &defaultPool;
+        }
+        std::lock_guard<std::mutex> glock(pools_mtx);
+        auto i = pools.find(name);
+        return i != pools.end() ? i->second.get() : nullptr;
+    }
 } // namespace stone
@@ -1,6 +1,7 @@
 #ifndef STONE_SCHEDULER_HPP
 #define STONE_SCHEDULER_HPP
 
+#include <algorithm>
 #include <thread>
 #include <condition_variable>
 #include <vector>
@@ -12,8 +13,23 @@
 #include <map>
 #include <unordered_map>
 #include <tuple>
+#include <atomic>
+#include <memory>
+#include <string>
+
+#ifdef __linux__
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#endif
 
 #include "stoneconfig.hpp"
+#include "timingwheel.hpp"
+#include "function.hpp"
+#include "histogram.hpp"
+#include "trace.hpp"
 
 constexpr unsigned long long operator"" _us(unsigned long long value)
 {
@@ -32,9 +48,13 @@ constexpr unsigned long long operator"" _sec(unsigned long long value)
 
 namespace stone
 {
+    // events are interned into compact ids, see Scheduler::registerEvent
+    using EventId = std::size_t;
+    constexpr EventId INVALID_EVENT = static_cast<EventId>(-1);
+
     inline auto timepoint_now()
     {
-        return std::chrono::high_resolution_clock::now();
+        return std::chrono::steady_clock::now();
     }
 
     inline auto timepoint_shift(unsigned long long us)
@@ -43,11 +63,22 @@ namespace stone
         return tp;
     }
 
+    inline uint64_t elapsed_ns(const std::chrono::steady_clock::time_point &from,
+                               const std::chrono::steady_clock::time_point &to)
+    {
+        return to > from ? std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count() : 0;
+    }
+
+    class ThreadPool;
+    class Scheduler;
+
     class WorkItem
     {
         friend class ThreadPool;
         friend class Scheduler;
         friend class WorkItemFlow;
+        friend class TaskGraph;
+        friend class TaskHandle;
 
     public:
         enum class ScheduleType
@@ -57,7 +88,7 @@ namespace stone
             EVENT,
         };
 
-        std::function<void()> fn;
+        small_function<void()> fn;
 
         WorkItem() {}
         ~WorkItem() {}
@@ -66,12 +97,11 @@ namespace stone
         auto bind_once(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>
         {
             using return_type = typename std::result_of<F(Args...)>::type;
-            auto _fn = std::make_shared<std::packaged_task<return_type()>>(
-                std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-            auto future = _fn->get_future();
-            this->fn = [_fn]()
+            std::packaged_task<return_type()> _fn(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+            auto future = _fn.get_future();
+            this->fn = [_fn = std::move(_fn)]() mutable
             {
-                (*_fn)();
+                _fn();
             };
             this->schedule_type = ScheduleType::ONCE;
             return future;
@@ -86,7 +116,6 @@ namespace stone
                 _fn();
             };
             this->schedule_type = ScheduleType::INTERVAL;
-            this->interval_stop = false;
         }
 
         template <class F, class... Args>
@@ -105,26 +134,130 @@ namespace stone
             this->priority = priority;
         }
 
-        void clear_interval()
+        // absolute deadline, the ordering key of an EDF pool.
+        // a task that finishes after its deadline counts as a miss.
+        void set_deadline(const std::chrono::steady_clock::time_point &tp)
+        {
+            this->deadline = tp;
+            this->relative_deadline = std::chrono::microseconds(0);
+        }
+
+        // deadline relative to every release by a Scheduler: scheduling, timer expiry,
+        // interval period or event. interval tasks use their period unless this is set.
+        void set_relative_deadline(unsigned long long us)
+        {
+            this->relative_deadline = std::chrono::microseconds(us);
+        }
+
+        std::chrono::steady_clock::time_point get_deadline() const
+        {
+            return this->deadline;
+        }
+
+        uint64_t deadline_misses() const
         {
-            this->interval_stop = true;
+            return this->misses.load(std::memory_order_relaxed);
+        }
+
+        // the pool a Scheduler hands this task to, nullptr for the scheduler's own pool.
+        void set_pool(ThreadPool *pool)
+        {
+            this->pool = pool;
+        }
+
+        ThreadPool *get_pool() const
+        {
+            return this->pool;
+        }
+
+        // stops an interval task, same as cancelling its handle
+        void clear_interval();
+
+        // starts recording lateness, queueing and execution time of this task.
+        // call it before the task is scheduled.
+        std::shared_ptr<TaskStats> enable_stats()
+        {
+            if (!this->stats)
+            {
+                this->stats = std::make_shared<TaskStats>();
+            }
+            return this->stats;
+        }
+
+        // nullptr unless enable_stats() was called
+        std::shared_ptr<TaskStats> get_stats() const
+        {
+            return this->stats;
         }
 
     private:
-        void add_dependency(const std::shared_ptr<WorkItem> &workitem)
+        void mark_enqueued()
+        {
+            if (this->stats)
+            {
+                this->enqueue_time = timepoint_now();
+            }
+        }
+
+        void mark_due()
+        {
+            if (this->stats)
+            {
+                this->stats->lateness.record(elapsed_ns(this->wakeup_time, timepoint_now()));
+            }
+        }
+
+        // derives the deadline from the release time, if the task has a relative one
+        void mark_released(const std::chrono::steady_clock::time_point &release)
+        {
+            auto relative = this->relative_deadline;
+            if (relative.count() == 0 && this->schedule_type == ScheduleType::INTERVAL)
+            {
+                relative = this->interval_us;
+            }
+            if (relative.count() > 0)
+            {
+                this->deadline = release + relative;
+            }
+        }
+
+        bool has_relative_deadline() const
         {
-            this->dependencies_count++;
-            workitem->super_dependencies.push_back(this);
+            return this->relative_deadline.count() > 0 || this->schedule_type == ScheduleType::INTERVAL;
+        }
+
+        // what a waiting task waits for, see Scheduler::arm()
+        enum class WaitKind
+        {
+            NONE,
+            TIMER,
+            EVENT,
+            DEPENDENCIES,
+        };
+
+        // super_item runs after workitem
+        static void add_dependency(const std::shared_ptr<WorkItem> &super_item, const std::shared_ptr<WorkItem> &workitem)
+        {
+            super_item->dependencies_count++;
+            workitem->super_dependencies.push_back(super_item);
         }
         // priority
         std::size_t priority = 0;
 
-        // used for waking up the task
-        std::size_t dependencies_count = 0;
+        // overrides the pool of the scheduler
+        ThreadPool *pool = nullptr;
+
+        // max() for none
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        std::chrono::microseconds relative_deadline = std::chrono::microseconds(0);
+        std::atomic<uint64_t> misses{0};
+
+        // used for waking up the task, decremented by the workers running the dependencies
+        std::atomic<std::size_t> dependencies_count{0};
 
         // record the tasks which depend on this.
-        // the tasks in this vector, must have not been called.
-        std::vector<WorkItem *> super_dependencies;
+        // the tasks in this vector, must have not been called. a cancelled one may be gone.
+        std::vector<std::weak_ptr<WorkItem>> super_dependencies;
 
         // indicate the schedule type
         ScheduleType schedule_type = ScheduleType::ONCE;
@@ -133,14 +266,33 @@ namespace stone
         std::chrono::steady_clock::time_point wakeup_time;
 
         // used in INTERVAL
-        volatile bool interval_stop = false;
         std::chrono::microseconds interval_us = std::chrono::microseconds(0);
 
+        // even while the task waits to be released by a scheduler, odd otherwise.
+        // every wait, release and cancel moves it on, so timer and event entries that
+        // carry an older value are stale and get dropped.
+        std::atomic<uint64_t> generation{1};
+        // the generation of the latest release, a repeating task only waits again from there.
+        // stored with release order after the generation moved on, rearm() loads it with acquire.
+        std::atomic<uint64_t> released{0};
+        // set when a timer or scheduleInterval releases the task, cleared once its run is done
+        std::atomic<bool> in_flight{false};
+        // guarded by timed_items_mtx. a reschedule while in flight waits for the run to finish
+        bool rescheduled = false;
+        std::chrono::steady_clock::time_point rescheduled_time;
+        std::atomic<WaitKind> wait{WaitKind::NONE};
+        // the scheduler that scheduled the task last
+        Scheduler *owner = nullptr;
+
         // used in EVENT
-        std::string event;
+        EventId event = INVALID_EVENT;
 
         // needed by scheduling.
-        std::function<void(const std::shared_ptr<WorkItem> &)> fn_done;
+        small_function<void(const std::shared_ptr<WorkItem> &)> fn_done;
+
+        // optional instrumentation
+        std::shared_ptr<TaskStats> stats;
+        std::chrono::steady_clock::time_point enqueue_time;
     };
 
     template <class F, class... Args>
@@ -171,350 +323,1478 @@ namespace stone
 
     class ThreadPool
     {
-    private:
-        class PriorityCompare
+    public:
+        enum class QueueMode
+        {
+            // all workers share one priority queue
+            SHARED,
+            // every worker owns a priority queue, idle workers steal from the others.
+            // priority holds within a queue: a worker runs its own most urgent item even if
+            // another queue holds a more urgent one. an idle worker steals the most urgent
+            // item on top of the other queues.
+            WORK_STEALING,
+        };
+
+        // order in which the workers take queued items
+        enum class OrderPolicy
+        {
+            // smallest priority first, earlier deadline breaks ties
+            PRIORITY,
+            // earliest deadline first, tasks without deadline last, priority breaks ties
+            EDF,
+        };
+
+        enum class SchedPolicy
+        {
+            // keep the policy of the creating thread
+            OTHER,
+            // SCHED_FIFO, needs CAP_SYS_NICE or an rtprio limit
+            FIFO,
+            // SCHED_RR
+            RR,
+        };
+
+        class Band
         {
         public:
-            bool operator()(const std::shared_ptr<WorkItem> &a, const std::shared_ptr<WorkItem> &b)
-            {
-                return a->priority > b->priority;
-            }
+            // items with a priority up to this value belong to the band, the last band takes the rest
+            std::size_t max_priority = 0;
+            // workers that only run items of this band or of more urgent bands
+            std::size_t reserved = 0;
         };
-        std::vector<std::thread> _threads;
-        std::priority_queue<std::shared_ptr<WorkItem>, std::vector<std::shared_ptr<WorkItem>>, PriorityCompare> work_queue;
-        std::mutex work_queue_mtx;
-        std::condition_variable work_queue_cv;
-        volatile bool stop = false;
 
-        void worker_loop()
+        class Config
         {
-            while (true)
+        public:
+            // used by getPool() and as thread name prefix
+            std::string name = "stone";
+            std::size_t threads = THREAD_POOL_SIZE;
+            QueueMode mode = QueueMode::SHARED;
+            OrderPolicy order = OrderPolicy::PRIORITY;
+            // cpus the workers may run on, empty for no affinity
+            std::vector<int> cpus;
+            // pin worker i to cpus[i % cpus.size()] instead of the whole set
+            bool pin_each = false;
+            SchedPolicy policy = SchedPolicy::OTHER;
+            // 1 to 99 for FIFO and RR
+            int priority = 0;
+            // mlockall(MCL_CURRENT | MCL_FUTURE) before the workers start
+            bool lock_memory = false;
+            // bytes of stack every worker touches before running tasks, so a page fault
+            // does not hit the first deadline
+            std::size_t prefault_stack = 0;
+            // priority bands with their own queues, most urgent first. SHARED mode only,
+            // empty for a single queue. at least one worker always stays unreserved.
+            std::vector<Band> bands;
+            // an idle reserved worker also runs less urgent bands while another reserved
+            // worker of its band sleeps. the band gives up that worker until the lent item
+            // is done, a burst larger than the sleeping reserve waits for it. a band with a
+            // single reserved worker never lends.
+            bool lend_reserved = false;
+            // record how long items wait in each band, see bandQueueWait()
+            bool band_stats = false;
+        };
+
+    private:
+        class PriorityCompare
+        {
+        public:
+            OrderPolicy order = OrderPolicy::PRIORITY;
+
+            PriorityCompare() {}
+            explicit PriorityCompare(OrderPolicy order) : order(order) {}
+
+            // true if a runs after b
+            bool operator()(const std::shared_ptr<WorkItem> &a, const std::shared_ptr<WorkItem> &b) const
             {
-                std::shared_ptr<WorkItem> item;
+                if (order == OrderPolicy::EDF)
                 {
-                    std::unique_lock<std::mutex> ulock(work_queue_mtx);
-                    work_queue_cv.wait(ulock, [this]
-                                       { return stop || !work_queue.empty(); });
-                    if (stop)
+                    if (a->deadline != b->deadline)
                     {
-                        return;
+                        return a->deadline > b->deadline;
                     }
-                    item = work_queue.top();
-                    work_queue.pop();
-                }
-                if (item->fn)
-                {
-                    item->fn();
+                    return a->priority > b->priority;
                 }
-                if (item->fn_done)
+                if (a->priority != b->priority)
                 {
-                    item->fn_done(item);
+                    return a->priority > b->priority;
                 }
+                return a->deadline > b->deadline;
             }
-        }
+        };
+        using work_queue_t = std::priority_queue<std::shared_ptr<WorkItem>, std::vector<std::shared_ptr<WorkItem>>, PriorityCompare>;
 
-    public:
-        ThreadPool(std::size_t count)
+        class LocalQueue
         {
-            this->initThreads(count);
-        }
+        public:
+            explicit LocalQueue(OrderPolicy order) : queue(PriorityCompare(order)) {}
 
-        ThreadPool() {}
+            std::mutex mtx;
+            work_queue_t queue;
+        };
 
-        ~ThreadPool()
+        class BandQueue
         {
-            this->shutdown();
-        }
+        public:
+            explicit BandQueue(OrderPolicy order) : queue(PriorityCompare(order)) {}
 
-        void initThreads(std::size_t count)
-        {
-            _threads.reserve(count);
-            for (size_t i = 0; i < count; i++)
-            {
-                _threads.push_back(std::thread(&ThreadPool::worker_loop, this));
-            }
-        }
+            work_queue_t queue;
+            LatencyHistogram queue_wait;
+        };
 
-        void shutdown()
+        // workers that may take items up to the same band sleep together,
+        // so a push only wakes a worker that can run the item
+        class BandWaiters
         {
-            this->stop = true;
-            work_queue_cv.notify_all();
-            for (auto &&t : _threads)
-            {
-                t.join();
-            }
-        }
+        public:
+            std::condition_variable cv;
+            std::size_t sleeping = 0;
+        };
 
-        void push(const std::shared_ptr<WorkItem> &item)
-        {
-            {
-                std::lock_guard<std::mutex> glock(work_queue_mtx);
-                this->work_queue.push(item);
-            }
-            work_queue_cv.notify_one();
-        }
-    };
+        // the pool and the index of the worker running on this thread.
+        // used to keep items pushed by a worker in its own queue.
+        static inline thread_local ThreadPool *current_pool = nullptr;
+        static inline thread_local std::size_t current_index = 0;
 
-    class WorkItemFlow
-    {
-        friend class Scheduler;
+        Config config;
+        QueueMode mode = QueueMode::SHARED;
+        std::vector<std::thread> _threads;
+        // affinity, policy or memory locking requests the system refused
+        std::atomic<std::size_t> setup_failures{0};
+        std::atomic<std::size_t> workers_ready{0};
+        work_queue_t work_queue;
+        std::mutex work_queue_mtx;
+        std::condition_variable work_queue_cv;
+        std::atomic<bool> stop{false};
 
-    private:
-        bool finished_flag = false;
-        std::size_t priority = 20;
-        std::vector<std::deque<std::shared_ptr<WorkItem>>> levels;
+        // workers waiting on work_queue_cv
+        std::atomic<std::size_t> sleeping{0};
 
-    public:
-        WorkItemFlow(std::size_t level_count, std::size_t priority = 20)
-        {
-            if (level_count < 2)
-            {
-                level_count = 2;
-            }
-            levels.resize(level_count);
-            this->priority = priority;
-        }
+        // used in SHARED with bands, guarded by work_queue_mtx.
+        // band_waiters is indexed by the least urgent band a worker may take.
+        std::vector<std::unique_ptr<BandQueue>> band_queues;
+        std::vector<std::unique_ptr<BandWaiters>> band_waiters;
+        std::vector<std::size_t> worker_reach;
 
-        ~WorkItemFlow() {}
+        // used in WORK_STEALING
+        std::vector<std::unique_ptr<LocalQueue>> local_queues;
+        std::atomic<std::size_t> pending{0};
+        std::atomic<std::size_t> next_queue{0};
 
-        bool finished() const
+        // items of finished submit() calls, reused so that submitting does not allocate
+        std::mutex recycled_mtx;
+        std::vector<std::shared_ptr<WorkItem>> recycled;
+
+        std::shared_ptr<WorkItem> acquire_item()
         {
-            return this->finished_flag;
+            {
+                std::lock_guard<std::mutex> glock(recycled_mtx);
+                if (!recycled.empty())
+                {
+                    auto item = std::move(recycled.back());
+                    recycled.pop_back();
+                    return item;
+                }
+            }
+            auto item = std::make_shared<WorkItem>();
+            item->fn_done = [this](const std::shared_ptr<WorkItem> &done)
+            {
+                // drop the captures now, not when the item is reused
+                done->fn = nullptr;
+                std::lock_guard<std::mutex> glock(recycled_mtx);
+                recycled.push_back(done);
+            };
+            return item;
         }
 
-        // the smaller the level, the earlier it will be executed.
-        bool add(std::size_t level, const std::shared_ptr<WorkItem> &item)
+        static void run_item(const std::shared_ptr<WorkItem> &item)
         {
-            if (item->schedule_type != WorkItem::ScheduleType::ONCE)
+            STONE_TRACE_BEGIN("pool", "task", item->priority);
+            if (item->stats)
             {
-                return false;
+                auto start = timepoint_now();
+                item->stats->queued.record(elapsed_ns(item->enqueue_time, start));
+                if (item->fn)
+                {
+                    item->fn();
+                }
+                item->stats->execution.record(elapsed_ns(start, timepoint_now()));
             }
-            if (finished_flag)
+            else if (item->fn)
             {
-                return false;
+                item->fn();
             }
-            if (level >= levels.size())
+            if (item->deadline != std::chrono::steady_clock::time_point::max() && timepoint_now() > item->deadline)
             {
-                return false;
+                item->misses.fetch_add(1, std::memory_order_relaxed);
             }
-            item->set_priority(this->priority);
-            levels.at(level).push_back(item);
-            return true;
-        }
-
-        bool del(std::size_t level)
-        {
-            if (level >= levels.size())
+            STONE_TRACE_END("pool", "task", item->priority);
+            if (item->fn_done)
             {
-                return false;
+                item->fn_done(item);
             }
-            levels.at(level).clear();
         }
 
-        bool del(const std::shared_ptr<WorkItem> &item)
+        // applies the thread settings of the config to the calling worker
+        void setup_thread(std::size_t index)
         {
-            for (auto &&l : levels)
+#ifdef __linux__
+            pthread_t self = pthread_self();
+            // thread names are limited to 15 characters
+            std::string thread_name = config.name.substr(0, 11) + "/" + std::to_string(index % 1000);
+            pthread_setname_np(self, thread_name.c_str());
+            if (!config.cpus.empty())
             {
-                decltype(l.end()) todel = l.end();
-                for (auto i = l.begin(); i != l.end(); i++)
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                if (config.pin_each)
                 {
-                    if ((*i) == item)
-                    {
-                        todel = i;
-                        break;
-                    }
+                    CPU_SET(config.cpus[index % config.cpus.size()], &set);
                 }
-                if (todel == l.end())
+                else
                 {
-                    return false;
+                    for (int cpu : config.cpus)
+                    {
+                        CPU_SET(cpu, &set);
+                    }
                 }
-                else
+                if (pthread_setaffinity_np(self, sizeof(set), &set) != 0)
                 {
-                    l.erase(todel);
-                    return true;
+                    setup_failures++;
                 }
             }
-        }
-
-        bool del(std::size_t level, const std::shared_ptr<WorkItem> &item)
-        {
-            if (level >= levels.size())
-            {
-                return false;
-            }
-            auto &l = levels.at(level);
-            decltype(l.end()) todel = l.end();
-            for (auto i = l.begin(); i != l.end(); i++)
+            if (config.policy != SchedPolicy::OTHER)
             {
-                if ((*i) == item)
+                sched_param param{};
+                param.sched_priority = config.priority;
+                int policy = config.policy == SchedPolicy::FIFO ? SCHED_FIFO : SCHED_RR;
+                if (pthread_setschedparam(self, policy, &param) != 0)
                 {
-                    todel = i;
-                    break;
+                    setup_failures++;
                 }
             }
-            if (todel == l.end())
+            if (config.prefault_stack > 0)
             {
-                return false;
+                volatile unsigned char *stack = static_cast<unsigned char *>(alloca(config.prefault_stack));
+                for (std::size_t i = 0; i < config.prefault_stack; i += 4096)
+                {
+                    stack[i] = 0;
+                }
             }
-            else
+#else
+            (void)index;
+            if (!config.cpus.empty() || config.policy != SchedPolicy::OTHER)
             {
-                l.erase(todel);
-                return true;
+                setup_failures++;
             }
+#endif
+            workers_ready++;
         }
 
-        void finish()
+        void worker_loop(std::size_t index)
         {
-            for (size_t i = 1; i < levels.size(); i++)
+            setup_thread(index);
+            while (true)
             {
-                for (auto &&super_item : levels.at(i))
+                std::shared_ptr<WorkItem> item;
                 {
-                    for (auto &&item : levels.at(i - 1))
+                    std::unique_lock<std::mutex> ulock(work_queue_mtx);
+                    while (!stop && work_queue.empty())
+                    {
+                        // counted under the lock, so pushers know how many workers to wake
+                        sleeping++;
+                        work_queue_cv.wait(ulock);
+                        sleeping--;
+                    }
+                    if (stop)
                     {
-                        super_item->add_dependency(item);
+                        return;
                     }
+                    item = work_queue.top();
+                    work_queue.pop();
                 }
+                STONE_TRACE_INSTANT("pool", "pop", index);
+                run_item(item);
             }
-            finished_flag = true;
         }
-    };
 
-    class Scheduler
-    {
-    private:
-        class TimePointCompare
+        std::size_t band_of(std::size_t priority) const
         {
-        public:
-            bool operator()(const std::shared_ptr<WorkItem> &a, const std::shared_ptr<WorkItem> &b)
+            const std::size_t last = band_queues.size() - 1;
+            for (std::size_t b = 0; b < last; b++)
             {
-                return a->wakeup_time > b->wakeup_time;
+                if (priority <= config.bands[b].max_priority)
+                {
+                    return b;
+                }
             }
-        };
+            return last;
+        }
 
-        ThreadPool *pool;
-        std::thread th_schedule;
+        // work_queue_mtx must be held
+        bool take_band(std::size_t first, std::size_t reach, std::shared_ptr<WorkItem> &item, std::size_t &band)
+        {
+            for (std::size_t b = first; b <= reach; b++)
+            {
+                auto &queue = band_queues[b]->queue;
+                if (!queue.empty())
+                {
+                    item = queue.top();
+                    queue.pop();
+                    band = b;
+                    return true;
+                }
+            }
+            return false;
+        }
 
-        std::mutex sleep_items_mtx;
-        std::unordered_map<WorkItem *, std::shared_ptr<WorkItem>> sleep_items;
+        // work_queue_mtx must be held. a reserved worker takes a less urgent band only while
+        // another reserved worker of its own band sleeps, so that band keeps one in reserve.
+        bool take_lent(std::size_t reach, std::shared_ptr<WorkItem> &item, std::size_t &band)
+        {
+            const std::size_t last = band_queues.size() - 1;
+            if (!config.lend_reserved || reach >= last || band_waiters[reach]->sleeping == 0)
+            {
+                return false;
+            }
+            return take_band(reach + 1, last, item, band);
+        }
+
+        // work_queue_mtx must be held. picks the most specialized sleeping workers that can
+        // run an item of the band, available counts the sleepers not picked yet. with
+        // lend_reserved it falls back to a reserved band that keeps a sleeper after this one.
+        BandWaiters *pick_waiters(std::size_t band, std::vector<std::size_t> &available)
+        {
+            for (std::size_t r = band; r < band_waiters.size(); r++)
+            {
+                if (available[r] > 0)
+                {
+                    available[r]--;
+                    return band_waiters[r].get();
+                }
+            }
+            for (std::size_t r = band; config.lend_reserved && r-- > 0;)
+            {
+                if (available[r] > 1)
+                {
+                    available[r]--;
+                    return band_waiters[r].get();
+                }
+            }
+            return nullptr;
+        }
+
+        void band_worker_loop(std::size_t index)
+        {
+            setup_thread(index);
+            const std::size_t reach = worker_reach[index];
+            auto &waiters = *band_waiters[reach];
+            while (true)
+            {
+                std::shared_ptr<WorkItem> item;
+                std::size_t band = 0;
+                {
+                    std::unique_lock<std::mutex> ulock(work_queue_mtx);
+                    while (!stop && !take_band(0, reach, item, band) && !take_lent(reach, item, band))
+                    {
+                        waiters.sleeping++;
+                        waiters.cv.wait(ulock);
+                        waiters.sleeping--;
+                    }
+                    if (stop)
+                    {
+                        return;
+                    }
+                }
+                if (config.band_stats)
+                {
+                    band_queues[band]->queue_wait.record(elapsed_ns(item->enqueue_time, timepoint_now()));
+                }
+                STONE_TRACE_INSTANT("pool", "pop", band);
+                run_item(item);
+            }
+        }
+
+        template <class It>
+        void push_bands(It first, It last)
+        {
+            static thread_local std::vector<std::size_t> available;
+            static thread_local std::vector<BandWaiters *> wake;
+            {
+                std::lock_guard<std::mutex> glock(work_queue_mtx);
+                available.resize(band_waiters.size());
+                for (std::size_t r = 0; r < band_waiters.size(); r++)
+                {
+                    available[r] = band_waiters[r]->sleeping;
+                }
+                for (auto i = first; i != last; i++)
+                {
+                    if (config.band_stats)
+                    {
+                        (*i)->enqueue_time = timepoint_now();
+                    }
+                    (*i)->mark_enqueued();
+                    std::size_t band = band_of((*i)->priority);
+                    band_queues[band]->queue.push(*i);
+                    BandWaiters *waiters = pick_waiters(band, available);
+                    if (waiters != nullptr)
+                    {
+                        wake.push_back(waiters);
+                    }
+                }
+            }
+            for (auto &&waiters : wake)
+            {
+                waiters->cv.notify_one();
+            }
+            wake.clear();
+        }
+
+        bool pop_from(std::size_t index, std::shared_ptr<WorkItem> &item)
+        {
+            auto &local = *local_queues[index];
+            std::lock_guard<std::mutex> glock(local.mtx);
+            if (local.queue.empty())
+            {
+                return false;
+            }
+            item = local.queue.top();
+            local.queue.pop();
+            pending--;
+            return true;
+        }
+
+        // takes the top of the queue whose top is the most urgent. a queue may change between
+        // the scan and the pop, the steal then takes what is on top of it by then.
+        bool steal(std::size_t index, std::shared_ptr<WorkItem> &item, std::size_t &victim)
+        {
+            const std::size_t count = local_queues.size();
+            PriorityCompare runs_after(config.order);
+            std::shared_ptr<WorkItem> best;
+            for (std::size_t i = 1; i < count; i++)
+            {
+                std::size_t v = (index + i) % count;
+                auto &local = *local_queues[v];
+                std::lock_guard<std::mutex> glock(local.mtx);
+                if (!local.queue.empty() && (best == nullptr || runs_after(best, local.queue.top())))
+                {
+                    best = local.queue.top();
+                    victim = v;
+                }
+            }
+            return best != nullptr && pop_from(victim, item);
+        }
+
+        void stealing_worker_loop(std::size_t index)
+        {
+            setup_thread(index);
+            current_pool = this;
+            current_index = index;
+            while (true)
+            {
+                std::shared_ptr<WorkItem> item;
+                std::size_t victim = index;
+                bool found = pop_from(index, item) || steal(index, item, victim);
+                if (!found)
+                {
+                    std::unique_lock<std::mutex> ulock(work_queue_mtx);
+                    sleeping++;
+                    work_queue_cv.wait(ulock, [this]
+                                       { return stop || pending > 0; });
+                    sleeping--;
+                    if (stop)
+                    {
+                        return;
+                    }
+                    continue;
+                }
+                STONE_TRACE_INSTANT("pool", victim == index ? "pop" : "steal", victim);
+                run_item(item);
+            }
+        }
+
+    public:
+        ThreadPool(std::size_t count, QueueMode mode = QueueMode::SHARED, OrderPolicy order = OrderPolicy::PRIORITY)
+            : mode(mode), work_queue(PriorityCompare(order))
+        {
+            this->config.threads = count;
+            this->config.mode = mode;
+            this->config.order = order;
+            this->initThreads(count);
+        }
+
+        // a pool with its own workers, cpu set and scheduling policy
+        ThreadPool(const Config &config) : config(config), mode(config.mode), work_queue(PriorityCompare(config.order))
+        {
+            if (config.lock_memory)
+            {
+#ifdef __linux__
+                if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+                {
+                    setup_failures++;
+                }
+#else
+                setup_failures++;
+#endif
+            }
+            this->initThreads(config.threads);
+            // report setup failures and finish prefaulting before the first task arrives
+            while (workers_ready.load() < _threads.size())
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        ThreadPool() {}
+
+        ~ThreadPool()
+        {
+            this->shutdown();
+        }
+
+        void initThreads(std::size_t count)
+        {
+            _threads.reserve(count);
+            if (mode == QueueMode::WORK_STEALING)
+            {
+                local_queues.reserve(count);
+                for (size_t i = 0; i < count; i++)
+                {
+                    local_queues.push_back(std::make_unique<LocalQueue>(config.order));
+                }
+                for (size_t i = 0; i < count; i++)
+                {
+                    _threads.push_back(std::thread(&ThreadPool::stealing_worker_loop, this, i));
+                }
+                return;
+            }
+            if (config.bands.size() > 1)
+            {
+                const std::size_t last = config.bands.size() - 1;
+                for (size_t b = 0; b < config.bands.size(); b++)
+                {
+                    band_queues.push_back(std::make_unique<BandQueue>(config.order));
+                    band_waiters.push_back(std::make_unique<BandWaiters>());
+                }
+                // reserved workers first, the rest serves every band
+                for (size_t b = 0; b < config.bands.size(); b++)
+                {
+                    for (size_t r = 0; r < config.bands[b].reserved && worker_reach.size() + 1 < count; r++)
+                    {
+                        worker_reach.push_back(b);
+                    }
+                }
+                worker_reach.resize(count, last);
+                for (size_t i = 0; i < count; i++)
+                {
+                    _threads.push_back(std::thread(&ThreadPool::band_worker_loop, this, i));
+                }
+                return;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                _threads.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+            }
+        }
+
+        void shutdown()
+        {
+            {
+                std::lock_guard<std::mutex> glock(work_queue_mtx);
+                this->stop = true;
+            }
+            work_queue_cv.notify_all();
+            for (auto &&waiters : band_waiters)
+            {
+                waiters->cv.notify_all();
+            }
+            for (auto &&t : _threads)
+            {
+                if (t.joinable())
+                {
+                    t.join();
+                }
+            }
+        }
+
+        std::size_t size() const
+        {
+            return _threads.size();
+        }
+
+        QueueMode queueMode() const
+        {
+            return this->mode;
+        }
+
+        OrderPolicy orderPolicy() const
+        {
+            return this->config.order;
+        }
+
+        const std::string &name() const
+        {
+            return this->config.name;
+        }
+
+        // 1 without bands
+        std::size_t bandCount() const
+        {
+            return band_queues.empty() ? 1 : band_queues.size();
+        }
+
+        // time items of the band waited for a worker, nullptr unless Config::band_stats is set
+        const LatencyHistogram *bandQueueWait(std::size_t band) const
+        {
+            if (!config.band_stats || band >= band_queues.size())
+            {
+                return nullptr;
+            }
+            return &band_queues[band]->queue_wait;
+        }
+
+        // number of thread settings that could not be applied, e.g. SCHED_FIFO without privileges.
+        // the workers still run, with the default settings.
+        std::size_t setupFailures() const
+        {
+            return setup_failures.load();
+        }
+
+        void push(const std::shared_ptr<WorkItem> &item)
+        {
+            if (!band_queues.empty())
+            {
+                push_bands(&item, &item + 1);
+                return;
+            }
+            item->mark_enqueued();
+            if (mode == QueueMode::WORK_STEALING)
+            {
+                // items pushed by our own workers stay local, others are spread round-robin
+                std::size_t index = (current_pool == this)
+                                        ? current_index
+                                        : next_queue.fetch_add(1, std::memory_order_relaxed) % local_queues.size();
+                {
+                    std::lock_guard<std::mutex> glock(local_queues[index]->mtx);
+                    local_queues[index]->queue.push(item);
+                }
+                pending++;
+                if (sleeping > 0)
+                {
+                    // a worker between its check and its wait holds the lock, so it cannot miss the notify
+                    {
+                        std::lock_guard<std::mutex> glock(work_queue_mtx);
+                    }
+                    work_queue_cv.notify_one();
+                }
+                return;
+            }
+            bool idle = false;
+            {
+                std::lock_guard<std::mutex> glock(work_queue_mtx);
+                this->work_queue.push(item);
+                idle = sleeping > 0;
+            }
+            if (idle)
+            {
+                work_queue_cv.notify_one();
+            }
+        }
+
+        // runs f on the pool. typical lambdas are stored inline in a recycled WorkItem,
+        // so once the pool is warmed up submitting does not allocate.
+        template <class F>
+        void submit(F &&f, std::size_t priority = 0)
+        {
+            auto item = acquire_item();
+            item->fn = std::forward<F>(f);
+            item->priority = priority;
+            push(item);
+        }
+
+        // pushes a batch of items and wakes at most one sleeping worker per item.
+        // the shared queue lock is taken once. with work stealing the batch is split into one
+        // chunk per worker queue, starting with the own queue when called from a worker.
+        template <class It>
+        void push_bulk(It first, It last)
+        {
+            if (first == last)
+            {
+                return;
+            }
+            std::size_t count = 0;
+            std::size_t idle = 0;
+            if (mode == QueueMode::WORK_STEALING)
+            {
+                count = static_cast<std::size_t>(std::distance(first, last));
+                const std::size_t queues = local_queues.size();
+                const std::size_t chunk = (count + queues - 1) / queues;
+                std::size_t start = (current_pool == this)
+                                        ? current_index
+                                        : next_queue.fetch_add(1, std::memory_order_relaxed);
+                auto i = first;
+                for (std::size_t q = 0; q < queues && i != last; q++)
+                {
+                    auto &local = *local_queues[(start + q) % queues];
+                    std::lock_guard<std::mutex> glock(local.mtx);
+                    for (std::size_t n = 0; n < chunk && i != last; n++, i++)
+                    {
+                        (*i)->mark_enqueued();
+                        local.queue.push(*i);
+                    }
+                }
+                pending += count;
+                if (sleeping == 0)
+                {
+                    return;
+                }
+                // a worker between its check and its wait holds the lock, so it cannot miss the notify
+                std::lock_guard<std::mutex> glock(work_queue_mtx);
+                idle = sleeping;
+            }
+            else if (!band_queues.empty())
+            {
+                push_bands(first, last);
+                return;
+            }
+            else
+            {
+                std::lock_guard<std::mutex> glock(work_queue_mtx);
+                for (auto i = first; i != last; i++)
+                {
+                    (*i)->mark_enqueued();
+                    this->work_queue.push(*i);
+                    count++;
+                }
+                idle = sleeping;
+            }
+            if (idle == 0)
+            {
+                return;
+            }
+            if (count >= idle)
+            {
+                work_queue_cv.notify_all();
+                return;
+            }
+            for (std::size_t n = 0; n < count; n++)
+            {
+                work_queue_cv.notify_one();
+            }
+        }
+    };
+
+    class WorkItemFlow
+    {
+        friend class Scheduler;
+
+    private:
+        bool finished_flag = false;
+        std::size_t priority = 20;
+        std::vector<std::deque<std::shared_ptr<WorkItem>>> levels;
+
+    public:
+        WorkItemFlow(std::size_t level_count, std::size_t priority = 20)
+        {
+            if (level_count < 2)
+            {
+                level_count = 2;
+            }
+            levels.resize(level_count);
+            this->priority = priority;
+        }
+
+        ~WorkItemFlow() {}
+
+        bool finished() const
+        {
+            return this->finished_flag;
+        }
+
+        // the smaller the level, the earlier it will be executed.
+        bool add(std::size_t level, const std::shared_ptr<WorkItem> &item)
+        {
+            if (item->schedule_type != WorkItem::ScheduleType::ONCE)
+            {
+                return false;
+            }
+            if (finished_flag)
+            {
+                return false;
+            }
+            if (level >= levels.size())
+            {
+                return false;
+            }
+            item->set_priority(this->priority);
+            levels.at(level).push_back(item);
+            return true;
+        }
+
+        bool del(std::size_t level)
+        {
+            if (level >= levels.size())
+            {
+                return false;
+            }
+            levels.at(level).clear();
+            return true;
+        }
+
+        bool del(const std::shared_ptr<WorkItem> &item)
+        {
+            for (auto &&l : levels)
+            {
+                decltype(l.end()) todel = l.end();
+                for (auto i = l.begin(); i != l.end(); i++)
+                {
+                    if ((*i) == item)
+                    {
+                        todel = i;
+                        break;
+                    }
+                }
+                if (todel != l.end())
+                {
+                    l.erase(todel);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool del(std::size_t level, const std::shared_ptr<WorkItem> &item)
+        {
+            if (level >= levels.size())
+            {
+                return false;
+            }
+            auto &l = levels.at(level);
+            decltype(l.end()) todel = l.end();
+            for (auto i = l.begin(); i != l.end(); i++)
+            {
+                if ((*i) == item)
+                {
+                    todel = i;
+                    break;
+                }
+            }
+            if (todel == l.end())
+            {
+                return false;
+            }
+            else
+            {
+                l.erase(todel);
+                return true;
+            }
+        }
+
+        void finish()
+        {
+            for (size_t i = 1; i < levels.size(); i++)
+            {
+                for (auto &&super_item : levels.at(i))
+                {
+                    for (auto &&item : levels.at(i - 1))
+                    {
+                        WorkItem::add_dependency(super_item, item);
+                    }
+                }
+            }
+            finished_flag = true;
+        }
+    };
+
+    // measures how late a timed sleep of the calling thread wakes up and returns twice the
+    // 90th percentile, bounded by SCHEDULER_SPIN_MARGIN_MAX_US. measured once per process.
+    // sleeps on a condition variable like wait_deadline does, so the futex wakeup path the
+    // timer thread takes is part of the measurement.
+    inline std::chrono::nanoseconds calibrated_spin_margin()
+    {
+        static const std::chrono::nanoseconds margin = []()
+        {
+            std::mutex mtx;
+            std::condition_variable cv;
+            std::unique_lock<std::mutex> ulock(mtx);
+            std::vector<std::chrono::nanoseconds> overshoot;
+            for (int i = 0; i < SCHEDULER_CALIBRATION_ROUNDS; i++)
+            {
+                auto deadline = timepoint_now() + std::chrono::microseconds(200);
+                while (timepoint_now() < deadline)
+                {
+                    cv.wait_until(ulock, deadline);
+                }
+                overshoot.push_back(timepoint_now() - deadline);
+            }
+            std::sort(overshoot.begin(), overshoot.end());
+            auto margin = overshoot[overshoot.size() * 9 / 10] * 2;
+            return std::min<std::chrono::nanoseconds>(margin, std::chrono::microseconds(SCHEDULER_SPIN_MARGIN_MAX_US));
+        }();
+        return margin;
+    }
+
+    // Refers to a task scheduled on a Scheduler. Cancelling or rescheduling is O(1): it only
+    // moves the task's generation on, the stale timer or event entry is dropped when it comes
+    // up, or earlier once stale entries outnumber the live ones.
+    class TaskHandle
+    {
+    public:
+        TaskHandle() {}
+        TaskHandle(Scheduler *scheduler, const std::shared_ptr<WorkItem> &item) : scheduler(scheduler), item(item) {}
+
+        bool valid() const
+        {
+            return this->scheduler != nullptr;
+        }
+
+        explicit operator bool() const
+        {
+            return valid();
+        }
+
+        // the task waits for its timer, event or dependencies
+        bool pending() const
+        {
+            auto i = this->item.lock();
+            return i != nullptr && (i->generation.load() & 1) == 0;
+        }
+
+        // drops the pending release. a repeating task also stops after a run in progress.
+        // a release already handed to the pool still runs. returns true if a pending release was dropped.
+        inline bool cancel();
+
+        // moves the next release of a once or interval task to tp, also after cancel().
+        // an interval task keeps its period afterwards. a release already handed to the pool
+        // still runs, the task waits for tp once that run is done.
+        inline bool reschedule(const std::chrono::steady_clock::time_point &tp);
+
+    private:
+        Scheduler *scheduler = nullptr;
+        std::weak_ptr<WorkItem> item;
+    };
+
+    class Scheduler
+    {
+        friend class WorkItem;
+
+    public:
+        enum class TimerBackend
+        {
+            // binary heap, O(log n) insert and expire
+            HEAP,
+            // hierarchical timing wheel, O(1) insert and expire with a fixed tick resolution
+            WHEEL,
+        };
+
+    private:
+        // a task waiting to be released, stale once the task's generation moved on
+        class Waiter
+        {
+        public:
+            std::shared_ptr<WorkItem> item;
+            uint64_t generation = 0;
+        };
+
+        class TimerEntry
+        {
+        public:
+            std::shared_ptr<WorkItem> item;
+            uint64_t generation = 0;
+            std::chrono::steady_clock::time_point wakeup_time;
+        };
+
+        class TimePointCompare
+        {
+        public:
+            bool operator()(const TimerEntry &a, const TimerEntry &b) const
+            {
+                return a.wakeup_time > b.wakeup_time;
+            }
+        };
+
+        // stale timer entries are compacted away once there are this many and more than live ones
+        static constexpr std::ptrdiff_t COMPACT_MIN_STALE = 64;
+
+        ThreadPool *pool;
+        std::thread th_schedule;
+
+        // tasks of a flow waiting for their dependencies
+        std::mutex sleep_items_mtx;
+        std::unordered_map<WorkItem *, Waiter> sleep_items;
+
+        std::condition_variable timed_items_cv;
+        std::mutex timed_items_mtx;
+        // binary heap on wakeup_time
+        std::vector<TimerEntry> timed_items;
+        TimerBackend timer_backend;
+        TimingWheel<TimerEntry> timer_wheel;
+        // what the timer thread sleeps for, max() while it has no timers
+        std::chrono::steady_clock::time_point timer_deadline = std::chrono::steady_clock::time_point::max();
+        // timer entries of cancelled or rescheduled tasks still in the heap or wheel.
+        // may be off by the cancels in flight, never for long.
+        std::atomic<std::ptrdiff_t> stale_timers{0};
+
+        class EventSlot
+        {
+        public:
+            std::mutex mtx;
+            std::vector<Waiter> waiting;
+            // the released waiters of an emit, kept to reuse the capacity
+            std::vector<std::shared_ptr<WorkItem>> ready;
+        };
+        // fixed table, so emitting an id neither allocates nor touches a shared lock
+        std::unique_ptr<EventSlot[]> event_slots;
+        std::atomic<std::size_t> event_count{0};
+        std::mutex event_names_mtx;
+        std::unordered_map<std::string, EventId> event_names;
+
+        std::atomic<bool> stop{false};
+
+        // in nanoseconds, negative until calibrated. adjusted by the thread in run(), read and
+        // set from any thread through spinMargin() and setSpinMargin()
+        std::atomic<int64_t> spin_margin{-1};
+        std::chrono::nanoseconds min_spin_margin{0};
+
+        // released now, or at its wakeup time when a timer expired
+        void dispatch(const std::shared_ptr<WorkItem> &item, bool timed = false)
+        {
+            if (item->has_relative_deadline())
+            {
+                item->mark_released(timed ? item->wakeup_time : timepoint_now());
+            }
+            (item->pool != nullptr ? item->pool : this->pool)->push(item);
+        }
+
+        // one batch if every item runs on the scheduler's pool
+        template <class It>
+        void dispatch_bulk(It first, It last)
+        {
+            for (auto i = first; i != last; i++)
+            {
+                if ((*i)->has_relative_deadline())
+                {
+                    (*i)->mark_released(timepoint_now());
+                }
+            }
+            for (auto i = first; i != last; i++)
+            {
+                if ((*i)->pool != nullptr && (*i)->pool != this->pool)
+                {
+                    for (auto j = first; j != last; j++)
+                    {
+                        ((*j)->pool != nullptr ? (*j)->pool : this->pool)->push(*j);
+                    }
+                    return;
+                }
+            }
+            this->pool->push_bulk(first, last);
+        }
 
-        std::condition_variable timed_items_cv;
-        std::mutex timed_items_mtx;
-        std::priority_queue<std::shared_ptr<WorkItem>, std::vector<std::shared_ptr<WorkItem>>, TimePointCompare> timed_items;
+        // timed_items_mtx must be held
+        void push_timed(TimerEntry &&entry)
+        {
+            auto tp = entry.wakeup_time;
+            if (timer_backend == TimerBackend::WHEEL)
+            {
+                timer_wheel.insert(std::move(entry), tp);
+            }
+            else
+            {
+                timed_items.push_back(std::move(entry));
+                std::push_heap(timed_items.begin(), timed_items.end(), TimePointCompare());
+            }
+            // the timer thread only has to wake up if its deadline moved closer
+            if (tp < timer_deadline)
+            {
+                timed_items_cv.notify_all();
+            }
+        }
+
+        // lets the task wait for a release and returns the generation its entry must carry.
+        // a wait the task was still in becomes stale.
+        uint64_t arm(WorkItem *item, WorkItem::WaitKind kind)
+        {
+            item->owner = this;
+            WorkItem::WaitKind previous = item->wait;
+            item->wait = kind;
+            uint64_t g = item->generation.load();
+            while (!item->generation.compare_exchange_weak(g, (g | 1) + 1))
+            {
+            }
+            if ((g & 1) == 0 && previous == WorkItem::WaitKind::TIMER)
+            {
+                stale_timers.fetch_add(1);
+            }
+            return (g | 1) + 1;
+        }
 
-        std::mutex event_items_mtx;
-        std::unordered_map<std::string, std::vector<std::shared_ptr<WorkItem>>> event_items;
+        // lets a repeating task wait again after a run. returns 0 if it was cancelled or
+        // rescheduled since its release.
+        uint64_t rearm(WorkItem *item, WorkItem::WaitKind kind)
+        {
+            uint64_t g = item->released.load(std::memory_order_acquire);
+            item->wait = kind;
+            return item->generation.compare_exchange_strong(g, g + 1) ? g + 1 : 0;
+        }
 
-        volatile bool stop = false;
+        // true if the entry is still the task's current wait, the task is then released
+        static bool release(WorkItem *item, uint64_t generation)
+        {
+            uint64_t g = generation;
+            if (item->generation.compare_exchange_strong(g, generation + 1))
+            {
+                item->released.store(generation + 1, std::memory_order_release);
+                return true;
+            }
+            return false;
+        }
 
-        void work_done_handler(const std::shared_ptr<WorkItem> &item)
+        // release() for a timer entry or the first run of an interval task. the task stays
+        // in flight until work_done_handler is done with it, see rescheduleAt()
+        static bool release_timed(WorkItem *item, uint64_t generation)
+        {
+            if (!release(item, generation))
+            {
+                return false;
+            }
+            item->in_flight.store(true);
+            return true;
+        }
+
+        // returns true if a pending release was dropped
+        bool cancel_item(WorkItem *item)
         {
-            // wake up the super tasks
-            for (auto &&i : item->super_dependencies)
+            uint64_t g = item->generation.load();
+            while (true)
             {
-                i->dependencies_count--;
-                if (i->dependencies_count == 0)
+                if (g & 1)
                 {
-                    // ensure that the super task exists
-                    if (sleep_items.find(i) != sleep_items.end())
+                    // queued, running or idle: a repeating task must not wait again
+                    if (item->generation.compare_exchange_weak(g, g + 2))
                     {
-                        pool->push(sleep_items[i]);
-                        sleep_items.erase(i);
+                        return false;
                     }
                 }
+                else if (item->generation.compare_exchange_weak(g, g + 1))
+                {
+                    break;
+                }
             }
-
-            if (item->schedule_type == WorkItem::ScheduleType::INTERVAL)
+            if (item->wait == WorkItem::WaitKind::TIMER)
             {
-                // interval schedule
-                item->wakeup_time = timepoint_now() + item->interval_us;
-                std::lock_guard<std::mutex> glock(timed_items_mtx);
-                timed_items.push(item);
-                timed_items_cv.notify_all();
+                stale_timers.fetch_add(1);
+                compact_timers();
             }
-            else if (item->schedule_type == WorkItem::ScheduleType::EVENT)
+            // kept until abandon() is done, the entry may hold the last reference
+            std::shared_ptr<WorkItem> parked;
+            if (item->wait == WorkItem::WaitKind::DEPENDENCIES)
             {
-                // event schedule
-                std::lock_guard<std::mutex> glock(event_items_mtx);
-                event_items[item->event].push_back(item);
+                // the remaining dependencies may never finish, work_done_handler skips a missing entry
+                std::lock_guard<std::mutex> glock(sleep_items_mtx);
+                auto sleeping = sleep_items.find(item);
+                if (sleeping != sleep_items.end())
+                {
+                    parked = std::move(sleeping->second.item);
+                    sleep_items.erase(sleeping);
+                }
             }
+            // event waiters are dropped at the next emit or schedule of the event
+            abandon(item);
+            return true;
         }
 
-    public:
-        Scheduler(ThreadPool *pool) : pool(pool) {}
-        ~Scheduler()
+        // the task will never run: its flow dependents cannot run either, and the
+        // dependency it would have resolved is resolved here instead.
+        void abandon(WorkItem *item)
         {
-            this->shutdown();
+            for (auto &&dependent : item->super_dependencies)
+            {
+                auto i = dependent.lock();
+                if (i != nullptr)
+                {
+                    cancel_item(i.get());
+                    i->dependencies_count.fetch_sub(1);
+                }
+            }
         }
 
-        void shutdown()
+        // drops the stale timer entries once they outnumber the live ones, amortized O(1)
+        void compact_timers()
         {
-            this->stop = true;
+            if (stale_timers.load() < COMPACT_MIN_STALE)
+            {
+                return;
+            }
+            std::lock_guard<std::mutex> glock(timed_items_mtx);
+            std::ptrdiff_t stale = stale_timers.load();
+            std::ptrdiff_t total = timer_backend == TimerBackend::WHEEL ? timer_wheel.size() : timed_items.size();
+            if (stale < COMPACT_MIN_STALE || 2 * stale < total)
+            {
+                return;
+            }
+            auto is_stale = [](const TimerEntry &e)
+            {
+                return e.item->generation.load() != e.generation;
+            };
+            std::size_t removed = 0;
+            if (timer_backend == TimerBackend::WHEEL)
+            {
+                removed = timer_wheel.remove_if(is_stale);
+            }
+            else
+            {
+                auto end = std::remove_if(timed_items.begin(), timed_items.end(), is_stale);
+                removed = timed_items.end() - end;
+                timed_items.erase(end, timed_items.end());
+                std::make_heap(timed_items.begin(), timed_items.end(), TimePointCompare());
+            }
+            stale_timers.fetch_sub(std::ptrdiff_t(removed));
         }
 
-        void run()
+        // sleeps until spin_margin before the deadline, then spins without the lock.
+        // returns early when a timer is added, the caller checks the timers again.
+        void wait_deadline(std::unique_lock<std::mutex> &ulock,
+                           const std::chrono::steady_clock::time_point &deadline)
         {
-            while (true)
+            timer_deadline = deadline;
+            auto margin = std::chrono::nanoseconds(spin_margin.load(std::memory_order_relaxed));
+            auto wake = deadline - margin;
+            if (timepoint_now() < wake)
+            {
+                if (timed_items_cv.wait_until(ulock, wake) == std::cv_status::timeout)
+                {
+                    // long sleeps wake up later than the calibration sleeps, follow the
+                    // observed wakeup latency but never go below the calibrated margin.
+                    // a single outlier moves the margin by at most 1/16.
+                    auto late = std::chrono::duration_cast<std::chrono::nanoseconds>(timepoint_now() - wake);
+                    auto target = std::max(min_spin_margin, std::min(2 * late, 2 * margin));
+                    margin += (target - margin) / 16;
+                    margin = std::min<std::chrono::nanoseconds>(margin, std::chrono::microseconds(SCHEDULER_SPIN_MARGIN_MAX_US));
+                    spin_margin.store(margin.count(), std::memory_order_relaxed);
+                }
+                return;
+            }
+            ulock.unlock();
+            while (timepoint_now() < deadline && !stop)
+            {
+            }
+            ulock.lock();
+        }
+
+        void run_heap()
+        {
+            std::unique_lock<std::mutex> ulock(timed_items_mtx);
+            while (!stop)
             {
-                std::shared_ptr<stone::WorkItem> item = nullptr;
-                timed_items_mtx.lock();
                 if (timed_items.empty())
                 {
-                    timed_items_mtx.unlock();
-                    std::unique_lock<std::mutex> ulock(timed_items_mtx);
-                    timed_items_cv.wait(ulock, [this]
-                                        { return stop || !timed_items.empty(); });
-                    if (stop)
+                    timer_deadline = std::chrono::steady_clock::time_point::max();
+                    timed_items_cv.wait(ulock);
+                    continue;
+                }
+                auto wakeup_time = timed_items.front().wakeup_time;
+                if (wakeup_time > timepoint_now())
+                {
+                    wait_deadline(ulock, wakeup_time);
+                    continue;
+                }
+                std::pop_heap(timed_items.begin(), timed_items.end(), TimePointCompare());
+                TimerEntry entry = std::move(timed_items.back());
+                timed_items.pop_back();
+                if (!release_timed(entry.item.get(), entry.generation))
+                {
+                    stale_timers.fetch_sub(1);
+                    continue;
+                }
+                auto item = std::move(entry.item);
+                item->wakeup_time = entry.wakeup_time;
+                ulock.unlock();
+                item->mark_due();
+                STONE_TRACE_INSTANT("scheduler", "timer", elapsed_ns(item->wakeup_time, timepoint_now()));
+                dispatch(item, true);
+                ulock.lock();
+            }
+        }
+
+        void run_wheel()
+        {
+            std::vector<TimerEntry> expired;
+            std::vector<std::shared_ptr<WorkItem>> due;
+            std::unique_lock<std::mutex> ulock(timed_items_mtx);
+            while (!stop)
+            {
+                timer_wheel.advance(timepoint_now(), expired);
+                for (auto &&entry : expired)
+                {
+                    if (release_timed(entry.item.get(), entry.generation))
                     {
-                        return;
+                        entry.item->wakeup_time = entry.wakeup_time;
+                        due.push_back(std::move(entry.item));
                     }
+                    else
+                    {
+                        stale_timers.fetch_sub(1);
+                    }
+                }
+                expired.clear();
+                if (!due.empty())
+                {
+                    // hand every expired item to the pool at once, outside the lock
+                    ulock.unlock();
+                    for (auto &&item : due)
+                    {
+                        item->mark_due();
+                        STONE_TRACE_INSTANT("scheduler", "timer", elapsed_ns(item->wakeup_time, timepoint_now()));
+                        dispatch(item, true);
+                    }
+                    due.clear();
+                    ulock.lock();
                     continue;
                 }
+                if (timer_wheel.empty())
+                {
+                    timer_deadline = std::chrono::steady_clock::time_point::max();
+                    timed_items_cv.wait(ulock);
+                }
                 else
                 {
-                    timed_items_mtx.unlock();
+                    wait_deadline(ulock, timer_wheel.next_expiry());
                 }
+            }
+        }
 
-                timed_items_mtx.lock();
-                auto interval_us = timed_items.top()->interval_us.count();
-                auto min_wakeup_time = timed_items.top()->wakeup_time;
-                auto current_tp = timepoint_now();
-                if (min_wakeup_time > current_tp)
+        void work_done_handler(const std::shared_ptr<WorkItem> &item)
+        {
+            // wake up the super tasks, all of them in one batch
+            static thread_local std::vector<std::shared_ptr<WorkItem>> ready;
+            for (auto &&dependent : item->super_dependencies)
+            {
+                // a cancelled super task is gone once nobody else holds it
+                auto i = dependent.lock();
+                if (i != nullptr && i->dependencies_count.fetch_sub(1) == 1)
                 {
-                    timed_items_mtx.unlock();
-                    if (interval_us <= 20 * 1000)
+                    // ensure that the super task exists and was not cancelled
+                    std::lock_guard<std::mutex> glock(sleep_items_mtx);
+                    auto sleeping = sleep_items.find(i.get());
+                    if (sleeping != sleep_items.end())
                     {
-                        while (true)
+                        if (release(i.get(), sleeping->second.generation))
                         {
-                            if (timepoint_now() >= min_wakeup_time)
-                            {
-                                break;
-                            }
+                            ready.push_back(std::move(sleeping->second.item));
                         }
+                        sleep_items.erase(sleeping);
                     }
-                    else
+                }
+            }
+            if (!ready.empty())
+            {
+                dispatch_bulk(ready.begin(), ready.end());
+                // keeps the capacity for the next completion on this thread
+                ready.clear();
+            }
+
+            if (item->in_flight.load() || item->schedule_type == WorkItem::ScheduleType::INTERVAL)
+            {
+                // a reschedule during the run, or the interval schedule, unless cancelled meanwhile
+                std::lock_guard<std::mutex> glock(timed_items_mtx);
+                if (item->rescheduled)
+                {
+                    item->rescheduled = false;
+                    uint64_t generation = rearm(item.get(), WorkItem::WaitKind::TIMER);
+                    if (generation != 0)
                     {
-                        std::unique_lock<std::mutex> ulock(timed_items_mtx);
-                        timed_items_cv.wait_for(ulock, (min_wakeup_time - timepoint_now()) / 2,
-                                                [this, &min_wakeup_time]
-                                                { return stop || timed_items.top()->wakeup_time < min_wakeup_time; });
+                        push_timed(TimerEntry{item, generation, item->rescheduled_time});
                     }
-
-                    if (stop)
+                }
+                else if (item->schedule_type == WorkItem::ScheduleType::INTERVAL)
+                {
+                    uint64_t generation = rearm(item.get(), WorkItem::WaitKind::TIMER);
+                    if (generation != 0)
                     {
-                        return;
+                        push_timed(TimerEntry{item, generation, timepoint_now() + item->interval_us});
                     }
-                    continue;
                 }
-                else
+                item->in_flight.store(false);
+            }
+            else if (item->schedule_type == WorkItem::ScheduleType::EVENT)
+            {
+                // event schedule
+                auto &slot = event_slots[item->event];
+                std::lock_guard<std::mutex> glock(slot.mtx);
+                uint64_t generation = rearm(item.get(), WorkItem::WaitKind::EVENT);
+                if (generation != 0)
                 {
-                    auto item = timed_items.top();
-                    timed_items.pop();
-                    this->pool->push(item);
-                    timed_items_mtx.unlock();
+                    slot.waiting.push_back(Waiter{item, generation});
                 }
             }
         }
 
+    public:
+        Scheduler(ThreadPool *pool,
+                  TimerBackend backend = TimerBackend::HEAP,
+                  unsigned long long tick_us = TIMING_WHEEL_TICK_US)
+            : pool(pool), timer_backend(backend), timer_wheel(tick_us),
+              event_slots(new EventSlot[SCHEDULER_MAX_EVENTS])
+        {
+        }
+
+        ~Scheduler()
+        {
+            this->shutdown();
+        }
+
+        void shutdown()
+        {
+            std::lock_guard<std::mutex> glock(timed_items_mtx);
+            this->stop = true;
+            timed_items_cv.notify_all();
+        }
+
+        TimerBackend timerBackend() const
+        {
+            return this->timer_backend;
+        }
+
+        ThreadPool *threadPool() const
+        {
+            return this->pool;
+        }
+
+        void run()
+        {
+#ifdef __linux__
+            // the default timer slack delays every timed wakeup by up to 50us
+            prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+#endif
+            if (spin_margin.load(std::memory_order_relaxed) < 0)
+            {
+                spin_margin.store(calibrated_spin_margin().count(), std::memory_order_relaxed);
+            }
+            min_spin_margin = spinMargin();
+            if (timer_backend == TimerBackend::WHEEL)
+            {
+                run_wheel();
+            }
+            else
+            {
+                run_heap();
+            }
+        }
+
+        // time before a deadline at which the timer thread stops sleeping and starts spinning.
+        // calibrated when run() starts unless set before, and raised while running if the
+        // thread wakes up later than that.
+        void setSpinMargin(std::chrono::nanoseconds margin)
+        {
+            this->spin_margin.store(margin.count(), std::memory_order_relaxed);
+        }
+
+        std::chrono::nanoseconds spinMargin() const
+        {
+            return std::chrono::nanoseconds(this->spin_margin.load(std::memory_order_relaxed));
+        }
+
         bool scheduleNow(const WorkItemFlow &flow)
         {
             std::lock_guard<std::mutex> glock(sleep_items_mtx);
@@ -529,15 +1809,16 @@ namespace stone
                     for (auto &&item : (*i))
                     {
                         item->fn_done = std::bind(&Scheduler::work_done_handler, this, std::placeholders::_1);
-                        pool->push(item);
                     }
+                    dispatch_bulk(i->begin(), i->end());
                 }
                 else
                 {
                     for (auto &&item : (*i))
                     {
                         item->fn_done = std::bind(&Scheduler::work_done_handler, this, std::placeholders::_1);
-                        sleep_items[item.get()] = item;
+                        uint64_t generation = arm(item.get(), WorkItem::WaitKind::DEPENDENCIES);
+                        sleep_items[item.get()] = Waiter{item, generation};
                     }
                 }
             }
@@ -553,7 +1834,7 @@ namespace stone
             item->fn_done = nullptr;
             if (item->dependencies_count == 0)
             {
-                pool->push(item);
+                dispatch(item);
                 return true;
             }
             else
@@ -562,66 +1843,226 @@ namespace stone
             }
         }
 
-        bool scheduleAt(const std::shared_ptr<WorkItem> &item,
-                        const std::chrono::steady_clock::time_point &tp)
+        TaskHandle scheduleAt(const std::shared_ptr<WorkItem> &item,
+                              const std::chrono::steady_clock::time_point &tp)
         {
             if (item->schedule_type != WorkItem::ScheduleType::ONCE)
             {
-                return false;
+                return TaskHandle();
             }
             item->fn_done = std::bind(&Scheduler::work_done_handler, this, std::placeholders::_1);
-            item->wakeup_time = tp;
             std::lock_guard<std::mutex> glock(timed_items_mtx);
-            timed_items.push(item);
-            timed_items_cv.notify_all();
-            return true;
+            uint64_t generation = arm(item.get(), WorkItem::WaitKind::TIMER);
+            push_timed(TimerEntry{item, generation, tp});
+            return TaskHandle(this, item);
         }
 
-        bool scheduleInterval(const std::shared_ptr<WorkItem> &item,
-                              unsigned long long interval_us)
+        // the first run is released right away
+        TaskHandle scheduleInterval(const std::shared_ptr<WorkItem> &item,
+                                    unsigned long long interval_us)
         {
             if (item->schedule_type != WorkItem::ScheduleType::INTERVAL)
             {
-                return false;
+                return TaskHandle();
             }
             item->fn_done = std::bind(&Scheduler::work_done_handler, this, std::placeholders::_1);
             item->interval_us = std::chrono::microseconds(interval_us);
-            pool->push(item);
-            return true;
+            if (release_timed(item.get(), arm(item.get(), WorkItem::WaitKind::NONE)))
+            {
+                dispatch(item);
+            }
+            return TaskHandle(this, item);
         }
 
-        bool scheduleEvent(const std::shared_ptr<WorkItem> &item, const std::string &event)
+        // see TaskHandle::cancel()
+        bool cancel(const std::shared_ptr<WorkItem> &item)
         {
-            if (item->schedule_type != WorkItem::ScheduleType::EVENT)
+            return cancel_item(item.get());
+        }
+
+        // see TaskHandle::reschedule(). only for tasks this scheduler scheduled before, not
+        // for event tasks and tasks of a flow.
+        bool rescheduleAt(const std::shared_ptr<WorkItem> &item,
+                          const std::chrono::steady_clock::time_point &tp)
+        {
+            if (item->schedule_type == WorkItem::ScheduleType::EVENT || item->owner != this ||
+                item->dependencies_count != 0 || !item->super_dependencies.empty())
             {
                 return false;
             }
+            {
+                std::lock_guard<std::mutex> glock(timed_items_mtx);
+                uint64_t g = item->generation.load();
+                if (item->in_flight.load() && (g & 1))
+                {
+                    // queued or running: work_done_handler arms the task once the run is done,
+                    // so it never runs twice at once. this also undoes an earlier cancel, a
+                    // later one moves the generation on and wins.
+                    item->released.store(g, std::memory_order_release);
+                    item->rescheduled = true;
+                    item->rescheduled_time = tp;
+                    return true;
+                }
+                uint64_t generation = arm(item.get(), WorkItem::WaitKind::TIMER);
+                push_timed(TimerEntry{item, generation, tp});
+            }
+            compact_timers();
+            return true;
+        }
+
+        // timers that will still fire, without the stale entries of cancelled tasks
+        std::size_t timerCount()
+        {
+            std::lock_guard<std::mutex> glock(timed_items_mtx);
+            std::ptrdiff_t total = timer_backend == TimerBackend::WHEEL ? timer_wheel.size() : timed_items.size();
+            std::ptrdiff_t live = total - stale_timers.load();
+            return live > 0 ? std::size_t(live) : 0;
+        }
+
+        // returns the id of the event, registering it on first use.
+        // returns INVALID_EVENT once SCHEDULER_MAX_EVENTS events exist.
+        EventId registerEvent(const std::string &event)
+        {
+            std::lock_guard<std::mutex> glock(event_names_mtx);
+            auto i = event_names.find(event);
+            if (i != event_names.end())
+            {
+                return i->second;
+            }
+            EventId id = event_count.load();
+            if (id >= SCHEDULER_MAX_EVENTS)
+            {
+                return INVALID_EVENT;
+            }
+            event_names[event] = id;
+            event_count.store(id + 1);
+            return id;
+        }
+
+        // returns the id of a registered event, INVALID_EVENT for an unknown name
+        EventId findEvent(const std::string &event)
+        {
+            std::lock_guard<std::mutex> glock(event_names_mtx);
+            auto i = event_names.find(event);
+            return i != event_names.end() ? i->second : INVALID_EVENT;
+        }
+
+        // an event task waits for every emit, a once task only for the next one
+        TaskHandle scheduleEvent(const std::shared_ptr<WorkItem> &item, EventId event)
+        {
+            if (item->schedule_type == WorkItem::ScheduleType::INTERVAL)
+            {
+                return TaskHandle();
+            }
+            if (event >= event_count.load())
+            {
+                return TaskHandle();
+            }
             item->event = event;
             item->fn_done = std::bind(&Scheduler::work_done_handler, this, std::placeholders::_1);
-            std::lock_guard<std::mutex> glock(event_items_mtx);
-            event_items[event].push_back(item);
-            return true;
+            auto &slot = event_slots[event];
+            std::lock_guard<std::mutex> glock(slot.mtx);
+            std::size_t n = slot.waiting.size();
+            if (n >= std::size_t(COMPACT_MIN_STALE) && (n & (n - 1)) == 0)
+            {
+                // before the list doubles, drop the waiters of cancelled tasks
+                slot.waiting.erase(std::remove_if(slot.waiting.begin(), slot.waiting.end(), [](const Waiter &w)
+                                                  { return w.item->generation.load() != w.generation; }),
+                                   slot.waiting.end());
+            }
+            slot.waiting.push_back(Waiter{item, arm(item.get(), WorkItem::WaitKind::EVENT)});
+            return TaskHandle(this, item);
+        }
+
+        TaskHandle scheduleEvent(const std::shared_ptr<WorkItem> &item, const std::string &event)
+        {
+            return scheduleEvent(item, registerEvent(event));
+        }
+
+        // hands every waiting task to the pool in one batch.
+        void emitEvent(EventId event)
+        {
+            if (event >= event_count.load())
+            {
+                return;
+            }
+            STONE_TRACE_INSTANT("scheduler", "emit", event);
+            auto &slot = event_slots[event];
+            std::lock_guard<std::mutex> glock(slot.mtx);
+            for (auto &&w : slot.waiting)
+            {
+                if (release(w.item.get(), w.generation))
+                {
+                    slot.ready.push_back(std::move(w.item));
+                }
+            }
+            // keeps the capacity, re-registering the tasks does not allocate
+            slot.waiting.clear();
+            dispatch_bulk(slot.ready.begin(), slot.ready.end());
+            slot.ready.clear();
         }
 
+        // nobody waits for an event that was never registered, the emit does nothing
         void emitEvent(const std::string &event)
         {
-            std::lock_guard<std::mutex> glock(event_items_mtx);
-            auto &items = event_items[event];
-            for (auto i = items.begin(); i != items.end();)
+            emitEvent(findEvent(event));
+        }
+
+        // number of tasks currently waiting for the event
+        std::size_t eventWaiters(EventId event)
+        {
+            if (event >= event_count.load())
             {
-                pool->push(*i);
-                i = items.erase(i);
+                return 0;
             }
+            auto &slot = event_slots[event];
+            std::lock_guard<std::mutex> glock(slot.mtx);
+            return std::count_if(slot.waiting.begin(), slot.waiting.end(), [](const Waiter &w)
+                                 { return w.item->generation.load() == w.generation; });
         }
     };
 
+    inline bool TaskHandle::cancel()
+    {
+        auto i = this->item.lock();
+        return i != nullptr && this->scheduler->cancel(i);
+    }
+
+    inline bool TaskHandle::reschedule(const std::chrono::steady_clock::time_point &tp)
+    {
+        auto i = this->item.lock();
+        return i != nullptr && this->scheduler->rescheduleAt(i, tp);
+    }
+
+    inline void WorkItem::clear_interval()
+    {
+        if (this->owner != nullptr)
+        {
+            this->owner->cancel_item(this);
+        }
+    }
+
+    extern ThreadPool defaultPool;
     extern Scheduler defaultScheduler;
 
+    // creates a named pool that lives until the program exits.
+    // returns nullptr if the name is taken, "default" names defaultPool.
+    ThreadPool *createPool(const ThreadPool::Config &config);
+
+    // nullptr if there is no pool with that name
+    ThreadPool *getPool(const std::string &name);
+
     inline void run()
     {
         defaultScheduler.run();
     }
 
+    template <class F>
+    inline void submit(F &&f, std::size_t priority = 0)
+    {
+        defaultScheduler.threadPool()->submit(std::forward<F>(f), priority);
+    }
+
     inline bool scheduleNow(const WorkItemFlow &flow)
     {
         return defaultScheduler.scheduleNow(flow);
@@ -632,23 +2073,43 @@ namespace stone
         return defaultScheduler.scheduleNow(item);
     }
 
-    inline bool scheduleAt(const std::shared_ptr<WorkItem> &item,
-                           const std::chrono::steady_clock::time_point &tp)
+    inline TaskHandle scheduleAt(const std::shared_ptr<WorkItem> &item,
+                                 const std::chrono::steady_clock::time_point &tp)
     {
         return defaultScheduler.scheduleAt(item, tp);
     }
 
-    inline bool scheduleInterval(const std::shared_ptr<WorkItem> &item,
-                                 unsigned long long interval_us)
+    inline TaskHandle scheduleInterval(const std::shared_ptr<WorkItem> &item,
+                                       unsigned long long interval_us)
     {
         return defaultScheduler.scheduleInterval(item, interval_us);
     }
 
-    inline bool scheduleEvent(const std::shared_ptr<WorkItem> &item, const std::string &event)
+    inline EventId registerEvent(const std::string &event)
+    {
+        return defaultScheduler.registerEvent(event);
+    }
+
+    inline EventId findEvent(const std::string &event)
+    {
+        return defaultScheduler.findEvent(event);
+    }
+
+    inline TaskHandle scheduleEvent(const std::shared_ptr<WorkItem> &item, EventId event)
     {
         return defaultScheduler.scheduleEvent(item, event);
     }
 
+    inline TaskHandle scheduleEvent(const std::shared_ptr<WorkItem> &item, const std::string &event)
+    {
+        return defaultScheduler.scheduleEvent(item, event);
+    }
+
+    inline void emitEvent(EventId event)
+    {
+        defaultScheduler.emitEvent(event);
+    }
+
     inline void emitEvent(const std::string &event)
     {
         defaultScheduler.emitEvent(event);
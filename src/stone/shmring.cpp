@@ -0,0 +1,285 @@
+#include "shmring.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <random>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace stone
+{
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory rings need lock-free 64 bit atomics");
+
+    static std::atomic<uint64_t> process_token{0};
+
+    // splitmix64 finalizer
+    static uint64_t mix_token(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+#ifdef __linux__
+    // runs in the child of a fork, which must not share the parent's origin.
+    // random_device may allocate, so the new token is derived without it.
+    static void renew_token_after_fork()
+    {
+        uint64_t seed = process_token.load(std::memory_order_relaxed) ^ uint64_t(getpid());
+        seed ^= uint64_t(std::chrono::steady_clock::now().time_since_epoch().count()) << 1;
+        process_token.store(mix_token(seed), std::memory_order_relaxed);
+    }
+#endif
+
+    ShmRing::~ShmRing()
+    {
+#ifdef __linux__
+        if (base != nullptr)
+        {
+            munmap(base, mapped_size);
+        }
+#endif
+    }
+
+#ifdef __linux__
+    // the creator sizes and fills in the segment before it writes the magic, wait for that.
+    static void *map_existing(int fd, std::size_t &mapped_size, std::size_t header_size, uint64_t magic)
+    {
+        auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        struct stat st;
+        while (fstat(fd, &st) != 0 || std::size_t(st.st_size) < header_size)
+        {
+            if (std::chrono::steady_clock::now() > give_up)
+            {
+                return nullptr;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        void *p = mmap(nullptr, std::size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        auto magic_word = static_cast<std::atomic<uint64_t> *>(p);
+        while (magic_word->load(std::memory_order_acquire) != magic)
+        {
+            if (std::chrono::steady_clock::now() > give_up)
+            {
+                munmap(p, std::size_t(st.st_size));
+                return nullptr;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        mapped_size = std::size_t(st.st_size);
+        return p;
+    }
+#endif
+
+    std::unique_ptr<ShmRing> ShmRing::open(const std::string &name, std::size_t msg_size, std::size_t capacity)
+    {
+#ifdef __linux__
+        processId();
+        std::size_t n = 1;
+        while (n < capacity)
+        {
+            n <<= 1;
+        }
+        std::size_t word_count = (msg_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        std::size_t slot_size = (sizeof(Slot) + word_count * sizeof(uint64_t) + 63) / 64 * 64;
+
+        std::unique_ptr<ShmRing> ring(new ShmRing());
+        ring->segment_name = name;
+        ring->msg_size = msg_size;
+
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+        if (fd >= 0)
+        {
+            std::size_t size = sizeof(Header) + n * slot_size;
+            void *p = MAP_FAILED;
+            if (ftruncate(fd, off_t(size)) == 0)
+            {
+                p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            close(fd);
+            if (p == MAP_FAILED)
+            {
+                shm_unlink(name.c_str());
+                return nullptr;
+            }
+            ring->base = static_cast<char *>(p);
+            ring->mapped_size = size;
+            // the new segment is zero filled, which is what every atomic starts with
+            Header *h = new (p) Header();
+            h->msg_size = msg_size;
+            h->capacity = n;
+            h->slot_size = slot_size;
+            h->tail.store(0, std::memory_order_relaxed);
+            h->magic.store(MAGIC, std::memory_order_release);
+        }
+        else
+        {
+            if (errno != EEXIST)
+            {
+                return nullptr;
+            }
+            fd = shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0)
+            {
+                return nullptr;
+            }
+            void *p = map_existing(fd, ring->mapped_size, sizeof(Header), MAGIC);
+            close(fd);
+            if (p == nullptr)
+            {
+                return nullptr;
+            }
+            ring->base = static_cast<char *>(p);
+        }
+        ring->header = reinterpret_cast<Header *>(ring->base);
+        if (ring->header->msg_size != msg_size)
+        {
+            return nullptr;
+        }
+        ring->slot_count = ring->header->capacity;
+        ring->slot_mask = ring->slot_count - 1;
+        ring->slot_size = ring->header->slot_size;
+        if (ring->mapped_size < sizeof(Header) + ring->slot_count * ring->slot_size)
+        {
+            return nullptr;
+        }
+        return ring;
+#else
+        (void)name;
+        (void)msg_size;
+        (void)capacity;
+        return nullptr;
+#endif
+    }
+
+    bool ShmRing::unlink(const std::string &name)
+    {
+#ifdef __linux__
+        return shm_unlink(name.c_str()) == 0;
+#else
+        (void)name;
+        return false;
+#endif
+    }
+
+    uint64_t ShmRing::processId()
+    {
+        static const bool created = []()
+        {
+            std::random_device rd;
+            uint64_t seed = (uint64_t(rd()) << 32) ^ uint64_t(rd());
+            process_token.store(mix_token(seed), std::memory_order_relaxed);
+#ifdef __linux__
+            pthread_atfork(nullptr, nullptr, renew_token_after_fork);
+#endif
+            return true;
+        }();
+        (void)created;
+        return process_token.load(std::memory_order_relaxed);
+    }
+
+    bool ShmRing::write(const void *msg, uint64_t origin)
+    {
+        uint64_t pos = header->tail.fetch_add(1, std::memory_order_relaxed);
+        Slot &s = slot(pos);
+        uint64_t busy = 2 * pos + 1;
+        // takes the slot from any older round, also from a writer that died while writing
+        uint64_t current = s.seq.load(std::memory_order_relaxed);
+        do
+        {
+            if (current >= busy)
+            {
+                return false;
+            }
+        } while (!s.seq.compare_exchange_weak(current, busy, std::memory_order_acquire, std::memory_order_relaxed));
+        std::atomic_thread_fence(std::memory_order_release);
+
+        s.origin.store(origin, std::memory_order_relaxed);
+        std::atomic<uint64_t> *w = words(s);
+        auto src = static_cast<const char *>(msg);
+        for (std::size_t offset = 0, i = 0; offset < msg_size; offset += sizeof(uint64_t), i++)
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, src + offset, std::min(sizeof(uint64_t), msg_size - offset));
+            w[i].store(word, std::memory_order_relaxed);
+        }
+        // fails if a writer of a later round took the slot meanwhile
+        return s.seq.compare_exchange_strong(busy, busy + 1, std::memory_order_release, std::memory_order_relaxed);
+    }
+
+    bool ShmRing::abandoned(uint64_t pos) const
+    {
+        if (tail() <= pos)
+        {
+            return false;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (stall_pos != pos)
+        {
+            stall_pos = pos;
+            stall_since = now;
+            return false;
+        }
+        return now - stall_since >= std::chrono::microseconds(SHM_RING_STALL_US);
+    }
+
+    bool ShmRing::read(uint64_t &cursor, void *out, uint64_t &origin, std::size_t &lost) const
+    {
+        auto dst = static_cast<char *>(out);
+        while (true)
+        {
+            uint64_t pos = cursor;
+            Slot &s = slot(pos);
+            uint64_t done = 2 * pos + 2;
+            uint64_t begin = s.seq.load(std::memory_order_acquire);
+            if (begin < done)
+            {
+                // not written yet, or still being written
+                if (!abandoned(pos))
+                {
+                    return false;
+                }
+                lost++;
+                cursor = pos + 1;
+                continue;
+            }
+            if (begin == done)
+            {
+                uint64_t o = s.origin.load(std::memory_order_relaxed);
+                std::atomic<uint64_t> *w = words(s);
+                for (std::size_t offset = 0, i = 0; offset < msg_size; offset += sizeof(uint64_t), i++)
+                {
+                    uint64_t word = w[i].load(std::memory_order_relaxed);
+                    std::memcpy(dst + offset, &word, std::min(sizeof(uint64_t), msg_size - offset));
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (s.seq.load(std::memory_order_relaxed) == done)
+                {
+                    origin = o;
+                    cursor = pos + 1;
+                    return true;
+                }
+            }
+            // a later round overwrote the slot, go on with the oldest message still in the ring
+            uint64_t t = tail();
+            uint64_t oldest = t > slot_count ? t - slot_count : 0;
+            uint64_t next = oldest > pos + 1 ? oldest : pos + 1;
+            lost += std::size_t(next - pos);
+            cursor = next;
+        }
+    }
+} // namespace stone
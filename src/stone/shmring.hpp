@@ -0,0 +1,128 @@
+#ifndef STONE_SHMRING_HPP
+#define STONE_SHMRING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "stoneconfig.hpp"
+
+namespace stone
+{
+    // Broadcast ring of fixed size messages in a named POSIX shared memory segment
+    // (/dev/shm on Linux), shared by any number of writer and reader processes.
+    // Writers never wait for readers: a position is claimed with one fetch_add and the oldest
+    // message is overwritten once the ring is full. Every reader keeps its own cursor, so each
+    // one sees every message it does not fall a whole ring behind on.
+    // A slot is guarded by a sequence number like a seqlock, and the payload lives in relaxed
+    // atomic words, so copying it while a writer overwrites it is well defined.
+    // A writer that dies while writing stalls readers at its slot for SHM_RING_STALL_US,
+    // then they skip the slot and count it as lost.
+    class ShmRing
+    {
+    public:
+        ~ShmRing();
+
+        ShmRing(const ShmRing &) = delete;
+        ShmRing &operator=(const ShmRing &) = delete;
+
+        // opens the segment, or creates it with capacity (rounded up to a power of two).
+        // the capacity of an existing segment wins. returns nullptr if the segment cannot
+        // be mapped or holds messages of another size.
+        static std::unique_ptr<ShmRing> open(const std::string &name, std::size_t msg_size, std::size_t capacity);
+
+        // removes the name, mapped segments stay valid until they are closed.
+        static bool unlink(const std::string &name);
+
+        // copies msg_size bytes into the ring. returns false if a writer of a later round
+        // took the slot first, the message is lost then.
+        bool write(const void *msg, uint64_t origin);
+
+        // copies the message at cursor into out and moves the cursor on.
+        // returns false if there is nothing new yet. messages overwritten before they were
+        // read are skipped and added to lost, so is a slot left unpublished for
+        // SHM_RING_STALL_US. the stall is timed for the last cursor that waited on a slot.
+        bool read(uint64_t &cursor, void *out, uint64_t &origin, std::size_t &lost) const;
+
+        // origin of the messages written by this process: a random token created when the
+        // process opens its first ring, and again in a forked child. pids repeat across pid
+        // namespaces, so they cannot tell containers sharing /dev/shm apart.
+        static uint64_t processId();
+
+        // the position the next message will be written to, a new reader starts there
+        uint64_t tail() const
+        {
+            return header->tail.load(std::memory_order_acquire);
+        }
+
+        std::size_t capacity() const
+        {
+            return slot_count;
+        }
+
+        std::size_t msgSize() const
+        {
+            return msg_size;
+        }
+
+        const std::string &name() const
+        {
+            return segment_name;
+        }
+
+    private:
+        class Header
+        {
+        public:
+            // set last by the creator, the other fields are valid once it reads MAGIC
+            std::atomic<uint64_t> magic;
+            uint64_t msg_size;
+            uint64_t capacity;
+            uint64_t slot_size;
+            alignas(64) std::atomic<uint64_t> tail;
+        };
+
+        // followed by the message as (msg_size + 7) / 8 words
+        class Slot
+        {
+        public:
+            // 2 * pos + 1 while the message of position pos is written, 2 * pos + 2 once it is done
+            std::atomic<uint64_t> seq;
+            std::atomic<uint64_t> origin;
+        };
+
+        static constexpr uint64_t MAGIC = 0x73746f6e65726e67; // "stonerng"
+
+        ShmRing() {}
+
+        Slot &slot(uint64_t pos) const
+        {
+            return *reinterpret_cast<Slot *>(base + sizeof(Header) + (pos & slot_mask) * slot_size);
+        }
+
+        std::atomic<uint64_t> *words(Slot &s) const
+        {
+            return reinterpret_cast<std::atomic<uint64_t> *>(&s + 1);
+        }
+
+        // true once a reader waited SHM_RING_STALL_US on the slot of a taken position
+        bool abandoned(uint64_t pos) const;
+
+        std::string segment_name;
+        std::size_t msg_size = 0;
+        std::size_t slot_count = 0;
+        std::size_t slot_mask = 0;
+        std::size_t slot_size = 0;
+        std::size_t mapped_size = 0;
+        char *base = nullptr;
+        Header *header = nullptr;
+
+        // the position a reader waits on and since when
+        mutable uint64_t stall_pos = ~uint64_t(0);
+        mutable std::chrono::steady_clock::time_point stall_since;
+    };
+} // namespace stone
+
+#endif
@@ -3,5 +3,11 @@
 
 #include "datafly.hpp"
 #include "scheduler.hpp"
+#include "taskgraph.hpp"
+#include "parallel.hpp"
+#include "synchronizer.hpp"
+#include "coroutine.hpp"
+#include "trace.hpp"
+#include "recorder.hpp"
 
 #endif
\ No newline at end of file
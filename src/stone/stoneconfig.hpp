@@ -3,4 +3,43 @@
 
 #define THREAD_POOL_SIZE (4)
 
+// tick resolution of the timing wheel timer backend
+#define TIMING_WHEEL_TICK_US (100)
+
+// a Scheduler sleeps until shortly before a timer is due and spins for the rest.
+// the spin time is calibrated from the wakeup latency, but never longer than this.
+#define SCHEDULER_SPIN_MARGIN_MAX_US (2000)
+// timed sleeps measured by the calibration
+#define SCHEDULER_CALIBRATION_ROUNDS (32)
+
+// capacity of the event table of a Scheduler
+#define SCHEDULER_MAX_EVENTS (256)
+
+// topics declared at compile time get a slot each in a table of this size, see Topic
+#define DATAFLY_STATIC_TOPICS (256)
+
+// callables up to this size are stored inside a WorkItem without allocating
+#define TASK_FUNCTION_INLINE_SIZE (48)
+
+// records a timeline of tasks, timers, events and messages, see trace.hpp.
+// set by -DSTONE_TRACE=ON, the hooks compile to nothing otherwise
+#ifndef STONE_TRACE_ENABLE
+#define STONE_TRACE_ENABLE (0)
+#endif
+// trace events kept per thread, older ones are overwritten
+#define TRACE_BUFFER_EVENTS (16384)
+// buffers of exited threads kept until a dump, beyond that the oldest is reused unexported
+#define TRACE_RETIRED_BUFFERS (64)
+
+// a shared memory ring slot whose writer took it this long ago without publishing is
+// skipped by readers, its writer died or stalled
+#define SHM_RING_STALL_US (100000)
+
+// messages a Recorder queues for its writer thread, more are dropped
+#define RECORDER_QUEUE_SIZE (16384)
+// size of one log segment file
+#define RECORDER_SEGMENT_BYTES (64 * 1024 * 1024)
+// how long the writer thread of a Recorder sleeps when its queue is empty
+#define RECORDER_POLL_US (1000)
+
 #endif
\ No newline at end of file
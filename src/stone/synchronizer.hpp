@@ -0,0 +1,402 @@
+#ifndef STONE_SYNCHRONIZER_HPP
+#define STONE_SYNCHRONIZER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "datafly.hpp"
+
+namespace stone
+{
+    enum class SyncPolicy
+    {
+        // every message of a tuple carries the same stamp
+        EXACT,
+        // the stamps of a tuple lie within sync_options::slop of each other
+        APPROXIMATE,
+    };
+
+    class sync_options
+    {
+    public:
+        SyncPolicy policy = SyncPolicy::APPROXIMATE;
+        // largest stamp difference within a tuple, in the unit of the stamps. APPROXIMATE only.
+        uint64_t slop = std::numeric_limits<uint64_t>::max();
+        // messages of one topic that may wait for a match, older ones are dropped
+        std::size_t queue_size = 10;
+        // nullptr: the owner calls spin(). otherwise a task on the pool matches the messages as
+        // they arrive, at most one at a time.
+        ThreadPool *pool = nullptr;
+        std::size_t priority = 0;
+    };
+
+    // Matches the messages of several topics by their stamps and calls back once per tuple.
+    // The pivot of a match is the latest of the oldest waiting messages. Older messages of
+    // other topics that are further than slop away from it can never be matched and are
+    // dropped. From the rest every topic contributes the message closest to the pivot. For
+    // APPROXIMATE this can mean waiting for a message past the pivot before the closest one is
+    // known, unless the topic's queue is full. Messages of a topic must arrive in stamp order,
+    // a message older than the newest waiting one is dropped.
+    // Publishers only push into a lock-free queue per topic. Matching runs on one thread at a
+    // time, the one calling spin() or a task on sync_options::pool, so it takes no lock.
+    template <class... _T>
+    class Synchronizer
+    {
+    public:
+        static constexpr std::size_t TOPIC_COUNT = sizeof...(_T);
+        static_assert(TOPIC_COUNT >= 2, "a synchronizer needs at least two topics");
+
+        using callback_type = std::function<void(const std::shared_ptr<_T> &...)>;
+
+        // stamp is called with a const reference to a message of every topic type and returns
+        // its stamp as uint64_t, e.g. [](const auto &msg) { return msg.stamp_ns; }
+        template <class Stamp>
+        Synchronizer(const std::array<std::string, TOPIC_COUNT> &topic_names, Stamp stamp,
+                     const callback_type &cb, const sync_options &options = sync_options(),
+                     DataFlyMaster *master = &stone::master)
+            : Synchronizer(topic_names, stamp, cb, options, master, std::index_sequence_for<_T...>())
+        {
+        }
+
+        ~Synchronizer()
+        {
+            unsubscribe_all(std::index_sequence_for<_T...>());
+        }
+
+        Synchronizer(const Synchronizer &) = delete;
+        Synchronizer &operator=(const Synchronizer &) = delete;
+
+        // takes the queued messages of every topic and calls back for each tuple they complete,
+        // returns the number of tuples. only one thread at a time may spin.
+        std::size_t spin()
+        {
+            take_all(std::index_sequence_for<_T...>());
+            std::size_t n = 0;
+            while (match())
+            {
+                n++;
+            }
+            return n;
+        }
+
+        // false if a topic carries another message type, nothing is subscribed then
+        bool valid() const
+        {
+            return subscribed;
+        }
+
+        std::size_t matched() const
+        {
+            return matched_count.load(std::memory_order_relaxed);
+        }
+
+        // messages that left without a match: too far from every pivot, out of stamp order,
+        // or pushed out of a full queue
+        std::size_t dropped() const
+        {
+            return dropped_count.load(std::memory_order_relaxed);
+        }
+
+        // no match task is scheduled or running
+        bool idle() const
+        {
+            return drains.count() == 0;
+        }
+
+    private:
+        template <class _M>
+        class inlet : public subscriber_base
+        {
+        public:
+            using message_type = _M;
+
+            inlet(const std::string &topic_name, Synchronizer *owner, std::size_t queue_size)
+                : msgs(queue_size), owner(owner)
+            {
+                this->topic_name = topic_name;
+            }
+
+            bool idle() const override
+            {
+                return owner->idle();
+            }
+
+            BoundedRing<std::shared_ptr<_M>> msgs;
+
+        private:
+            void deliver(const void *msg) override
+            {
+                auto &ptr = *static_cast<const std::shared_ptr<_M> *>(msg);
+                if (!ptr)
+                {
+                    return;
+                }
+                if (!msgs.push(ptr))
+                {
+                    owner->dropped_count.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                owner->arrived();
+            }
+
+            Synchronizer *owner;
+        };
+
+        // waiting messages of one topic in stamp order, owned by the matching thread
+        template <class _M>
+        class window
+        {
+        public:
+            explicit window(std::size_t capacity) : msgs(capacity) {}
+
+            std::vector<std::shared_ptr<_M>> msgs;
+        };
+
+        template <class Stamp, std::size_t... I>
+        Synchronizer(const std::array<std::string, TOPIC_COUNT> &topic_names, Stamp stamp,
+                     const callback_type &cb, const sync_options &options, DataFlyMaster *master,
+                     std::index_sequence<I...>)
+            : master(master), callback(cb), options(options),
+              capacity(options.queue_size == 0 ? 1 : options.queue_size),
+              stamp_fns(std::function<uint64_t(const _T &)>(stamp)...),
+              inlets(std::make_unique<inlet<_T>>(topic_names[I], this, capacity)...),
+              windows(window<_T>(capacity)...)
+        {
+            if (this->options.policy == SyncPolicy::EXACT)
+            {
+                this->options.slop = 0;
+            }
+            for (auto &&stamps : stamp_table)
+            {
+                stamps.resize(capacity);
+            }
+            head.fill(0);
+            count.fill(0);
+            // every topic is checked before any is subscribed
+            subscribed = (master->template declare<_T>(topic_names[I]) && ...);
+            if (subscribed)
+            {
+                // subscribed last, a message may arrive as soon as the first inlet is registered
+                (master->add_subscriber(std::get<I>(inlets).get()), ...);
+            }
+        }
+
+        template <std::size_t... I>
+        void unsubscribe_all(std::index_sequence<I...>)
+        {
+            if (subscribed)
+            {
+                (master->unsubscribe(std::get<I>(inlets).get()), ...);
+            }
+        }
+
+        uint64_t stamp_at(std::size_t topic, std::size_t k) const
+        {
+            return stamp_table[topic][(head[topic] + k) % capacity];
+        }
+
+        template <std::size_t I>
+        void take()
+        {
+            auto &in = *std::get<I>(inlets);
+            auto &w = std::get<I>(windows);
+            std::shared_ptr<typename std::tuple_element<I, std::tuple<_T...>>::type> msg;
+            while (in.msgs.pop(msg))
+            {
+                uint64_t s = std::get<I>(stamp_fns)(*msg);
+                if (count[I] > 0 && s < stamp_at(I, count[I] - 1))
+                {
+                    dropped_count.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (count[I] == capacity)
+                {
+                    pop<I>(1);
+                    dropped_count.fetch_add(1, std::memory_order_relaxed);
+                }
+                std::size_t slot = (head[I] + count[I]) % capacity;
+                w.msgs[slot] = std::move(msg);
+                stamp_table[I][slot] = s;
+                count[I]++;
+            }
+        }
+
+        template <std::size_t... I>
+        void take_all(std::index_sequence<I...>)
+        {
+            (take<I>(), ...);
+        }
+
+        template <std::size_t I>
+        void pop(std::size_t n)
+        {
+            auto &w = std::get<I>(windows);
+            for (std::size_t k = 0; k < n; k++)
+            {
+                w.msgs[head[I]] = nullptr;
+                head[I] = (head[I] + 1) % capacity;
+            }
+            count[I] -= n;
+        }
+
+        template <std::size_t... I>
+        void pop_topic(std::size_t topic, std::size_t n, std::index_sequence<I...>)
+        {
+            ((I == topic ? pop<I>(n) : void()), ...);
+        }
+
+        template <std::size_t... I>
+        void emit(const std::array<std::size_t, TOPIC_COUNT> &chosen, std::index_sequence<I...>)
+        {
+            callback(std::get<I>(windows).msgs[(head[I] + chosen[I]) % capacity]...);
+            (pop<I>(chosen[I] + 1), ...);
+        }
+
+        // completes at most one tuple, returns false when none can be completed yet
+        bool match()
+        {
+            while (true)
+            {
+                uint64_t pivot = 0;
+                for (std::size_t i = 0; i < TOPIC_COUNT; i++)
+                {
+                    if (count[i] == 0)
+                    {
+                        return false;
+                    }
+                    pivot = std::max(pivot, stamp_at(i, 0));
+                }
+                // the pivot topic has nothing older, messages too far before the pivot never match
+                bool dropped = false, emptied = false;
+                for (std::size_t i = 0; i < TOPIC_COUNT; i++)
+                {
+                    std::size_t stale = 0;
+                    while (stale < count[i] && stamp_at(i, stale) < pivot && pivot - stamp_at(i, stale) > options.slop)
+                    {
+                        stale++;
+                    }
+                    if (stale > 0)
+                    {
+                        pop_topic(i, stale, std::index_sequence_for<_T...>());
+                        dropped_count.fetch_add(stale, std::memory_order_relaxed);
+                        dropped = true;
+                        emptied = emptied || count[i] == 0;
+                    }
+                }
+                if (emptied)
+                {
+                    return false;
+                }
+                if (dropped)
+                {
+                    // a new head may be past the pivot
+                    continue;
+                }
+                // every head is within slop before the pivot, so the closest message is as well
+                std::array<std::size_t, TOPIC_COUNT> chosen;
+                for (std::size_t i = 0; i < TOPIC_COUNT; i++)
+                {
+                    std::size_t best = 0;
+                    uint64_t distance = pivot - stamp_at(i, 0);
+                    bool known = distance == 0;
+                    for (std::size_t k = 1; k < count[i] && !known; k++)
+                    {
+                        uint64_t s = stamp_at(i, k);
+                        if (s >= pivot)
+                        {
+                            // stamps only grow from here
+                            known = true;
+                            if (s - pivot < distance)
+                            {
+                                best = k;
+                                distance = s - pivot;
+                            }
+                        }
+                        else
+                        {
+                            best = k;
+                            distance = pivot - s;
+                        }
+                    }
+                    if (!known && count[i] < capacity)
+                    {
+                        // a later message may still be closer to the pivot
+                        return false;
+                    }
+                    chosen[i] = best;
+                }
+                std::size_t skipped = 0;
+                for (auto &&c : chosen)
+                {
+                    skipped += c;
+                }
+                dropped_count.fetch_add(skipped, std::memory_order_relaxed);
+                emit(chosen, std::index_sequence_for<_T...>());
+                matched_count.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        template <std::size_t... I>
+        bool inlets_empty(std::index_sequence<I...>) const
+        {
+            return (std::get<I>(inlets)->msgs.empty() && ...);
+        }
+
+        void arrived()
+        {
+            if (options.pool != nullptr && drains.request(1))
+            {
+                submit_drain();
+            }
+        }
+
+        void submit_drain()
+        {
+            options.pool->submit([this]()
+                                 { this->drain(); },
+                                 options.priority);
+        }
+
+        void drain()
+        {
+            spin();
+            // once finish gives up the task's count the synchronizer may be gone, see idle()
+            if (drains.finish([this]()
+                              { return inlets_empty(std::index_sequence_for<_T...>()); }))
+            {
+                // more to do, but let other tasks of the pool run first
+                submit_drain();
+            }
+        }
+
+        DataFlyMaster *master;
+        callback_type callback;
+        sync_options options;
+        std::size_t capacity;
+        bool subscribed = false;
+
+        std::tuple<std::function<uint64_t(const _T &)>...> stamp_fns;
+        std::tuple<std::unique_ptr<inlet<_T>>...> inlets;
+
+        // owned by the matching thread, one ring of capacity messages per topic
+        std::tuple<window<_T>...> windows;
+        std::array<std::vector<uint64_t>, TOPIC_COUNT> stamp_table;
+        std::array<std::size_t, TOPIC_COUNT> head;
+        std::array<std::size_t, TOPIC_COUNT> count;
+
+        std::atomic<std::size_t> matched_count{0};
+        std::atomic<std::size_t> dropped_count{0};
+        drain_tasks drains;
+    };
+} // namespace stone
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef STONE_TASKGRAPH_HPP
+#define STONE_TASKGRAPH_HPP
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+
+#include "scheduler.hpp"
+
+namespace stone
+{
+    // Task graph with explicit edges between any two tasks.
+    // The graph is built once and can be launched again every cycle: a launch only resets
+    // one atomic join counter per task and pushes the tasks without predecessors.
+    class TaskGraph
+    {
+    public:
+        using node_id = std::size_t;
+
+    private:
+        class Node
+        {
+        public:
+            std::shared_ptr<WorkItem> item;
+            std::size_t index = 0;
+            std::vector<Node *> successors;
+            std::size_t predecessors = 0;
+            // predecessors still running in the current launch
+            std::atomic<std::size_t> join_counter{0};
+        };
+
+        std::size_t priority;
+        std::vector<std::unique_ptr<Node>> nodes;
+
+        // recomputed at launch after the edges changed
+        bool dirty = true;
+        bool acyclic = true;
+        std::vector<std::shared_ptr<WorkItem>> roots;
+
+        ThreadPool *pool = nullptr;
+        std::atomic<std::size_t> remaining{0};
+        std::mutex done_mtx;
+        std::condition_variable done_cv;
+        bool is_running = false;
+
+        void node_done(Node *node)
+        {
+            // successors that became ready are pushed in one batch
+            static thread_local std::vector<std::shared_ptr<WorkItem>> ready;
+            for (auto &&succ : node->successors)
+            {
+                if (succ->join_counter.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    ready.push_back(succ->item);
+                }
+            }
+            if (!ready.empty())
+            {
+                pool->push_bulk(ready.begin(), ready.end());
+                ready.clear();
+            }
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                // notify under the lock, the graph may be destroyed as soon as wait() returns
+                std::lock_guard<std::mutex> glock(done_mtx);
+                is_running = false;
+                done_cv.notify_all();
+            }
+        }
+
+        // finds the roots and checks that the graph has no cycle (Kahn's algorithm)
+        void prepare()
+        {
+            roots.clear();
+            std::vector<std::size_t> indegree(nodes.size());
+            std::vector<Node *> ready;
+            for (std::size_t i = 0; i < nodes.size(); i++)
+            {
+                indegree[i] = nodes[i]->predecessors;
+                if (indegree[i] == 0)
+                {
+                    roots.push_back(nodes[i]->item);
+                    ready.push_back(nodes[i].get());
+                }
+            }
+            std::size_t visited = 0;
+            while (!ready.empty())
+            {
+                Node *node = ready.back();
+                ready.pop_back();
+                visited++;
+                for (auto &&succ : node->successors)
+                {
+                    if (--indegree[succ->index] == 0)
+                    {
+                        ready.push_back(succ);
+                    }
+                }
+            }
+            acyclic = (visited == nodes.size());
+            dirty = false;
+        }
+
+    public:
+        TaskGraph(std::size_t priority = 20) : priority(priority) {}
+
+        ~TaskGraph()
+        {
+            this->wait();
+        }
+
+        TaskGraph(const TaskGraph &) = delete;
+        TaskGraph &operator=(const TaskGraph &) = delete;
+
+        std::size_t size() const
+        {
+            return nodes.size();
+        }
+
+        // the graph must not be changed while it is running.
+        template <class F, class... Args>
+        node_id add(F &&f, Args &&...args)
+        {
+            auto node = std::make_unique<Node>();
+            node->index = nodes.size();
+            node->item = std::make_shared<WorkItem>();
+            auto _fn = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+            node->item->fn = [_fn]()
+            {
+                _fn();
+            };
+            node->item->set_priority(priority);
+            Node *raw = node.get();
+            node->item->fn_done = [this, raw](const std::shared_ptr<WorkItem> &)
+            {
+                this->node_done(raw);
+            };
+            nodes.push_back(std::move(node));
+            dirty = true;
+            return nodes.size() - 1;
+        }
+
+        // before has to finish before after starts.
+        bool precede(node_id before, node_id after)
+        {
+            if (before >= nodes.size() || after >= nodes.size() || before == after || running())
+            {
+                return false;
+            }
+            nodes[before]->successors.push_back(nodes[after].get());
+            nodes[after]->predecessors++;
+            dirty = true;
+            return true;
+        }
+
+        bool running()
+        {
+            std::lock_guard<std::mutex> glock(done_mtx);
+            return is_running;
+        }
+
+        // returns false if the graph is still running or has a cycle.
+        bool launch(ThreadPool *pool)
+        {
+            {
+                std::lock_guard<std::mutex> glock(done_mtx);
+                if (is_running)
+                {
+                    return false;
+                }
+                if (dirty)
+                {
+                    prepare();
+                }
+                if (!acyclic)
+                {
+                    return false;
+                }
+                if (nodes.empty())
+                {
+                    return true;
+                }
+                is_running = true;
+            }
+            this->pool = pool;
+            for (auto &&node : nodes)
+            {
+                node->join_counter.store(node->predecessors, std::memory_order_relaxed);
+            }
+            // the pool's queue lock publishes the counters to the workers
+            remaining.store(nodes.size(), std::memory_order_release);
+            pool->push_bulk(roots.begin(), roots.end());
+            return true;
+        }
+
+        // blocks until the current launch is done.
+        // do not call it from a worker of the pool the graph runs on, it may hold the last worker.
+        void wait()
+        {
+            std::unique_lock<std::mutex> ulock(done_mtx);
+            done_cv.wait(ulock, [this]
+                         { return !is_running; });
+        }
+    };
+
+    inline bool scheduleNow(TaskGraph &graph)
+    {
+        return graph.launch(defaultScheduler.threadPool());
+    }
+} // namespace stone
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef STONE_TIMINGWHEEL_HPP
+#define STONE_TIMINGWHEEL_HPP
+
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+namespace stone
+{
+    // Hierarchical timing wheel.
+    // Insert and expire are O(1), an entry is moved down at most LEVEL_COUNT - 1 times
+    // before it expires. Time is divided into ticks of tick_us, an entry never expires
+    // before its time point and at most one tick after it.
+    template <class _T>
+    class TimingWheel
+    {
+    public:
+        using time_point = std::chrono::steady_clock::time_point;
+
+        static constexpr std::size_t SLOT_BITS = 8;
+        static constexpr std::size_t SLOT_COUNT = 1 << SLOT_BITS;
+        static constexpr std::size_t SLOT_MASK = SLOT_COUNT - 1;
+        static constexpr std::size_t LEVEL_COUNT = 4;
+        // the farthest slot an entry can be placed in. a later entry waits in that slot and is
+        // placed again when it cascades, as often as needed.
+        static constexpr uint64_t MAX_DELTA = (uint64_t(1) << (SLOT_BITS * LEVEL_COUNT)) - 1;
+
+    private:
+        class Entry
+        {
+        public:
+            _T value;
+            // the tick the entry is due at
+            uint64_t due_tick;
+            // the tick of the slot it is placed in, before due_tick if that is too far away
+            uint64_t expire_tick;
+        };
+
+        std::chrono::microseconds tick;
+        time_point origin;
+        // the next tick to be processed, all earlier ticks have expired
+        uint64_t next_tick = 0;
+        std::size_t count = 0;
+
+        std::vector<Entry> slots[LEVEL_COUNT][SLOT_COUNT];
+        std::vector<Entry> cascade_buffer;
+
+        void place(Entry &&entry)
+        {
+            uint64_t expire = entry.due_tick;
+            if (expire < next_tick)
+            {
+                expire = next_tick;
+            }
+            uint64_t delta = expire - next_tick;
+            if (delta > MAX_DELTA)
+            {
+                delta = MAX_DELTA;
+                expire = next_tick + MAX_DELTA;
+            }
+            std::size_t level = 0;
+            while (level < LEVEL_COUNT - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+            {
+                level++;
+            }
+            entry.expire_tick = expire;
+            slots[level][(expire >> (SLOT_BITS * level)) & SLOT_MASK].push_back(std::move(entry));
+        }
+
+        // the first tick at or after tp, so that an entry never expires early
+        uint64_t tick_of(const time_point &tp) const
+        {
+            if (tp <= origin)
+            {
+                return 0;
+            }
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(tp - origin);
+            if (origin + us < tp)
+            {
+                us += std::chrono::microseconds(1);
+            }
+            return (us.count() + tick.count() - 1) / tick.count();
+        }
+
+        // moves the entries of a higher level slot down, returns the slot index.
+        std::size_t cascade(std::size_t level)
+        {
+            std::size_t index = (next_tick >> (SLOT_BITS * level)) & SLOT_MASK;
+            cascade_buffer.swap(slots[level][index]);
+            for (auto &&entry : cascade_buffer)
+            {
+                place(std::move(entry));
+            }
+            cascade_buffer.clear();
+            return index;
+        }
+
+    public:
+        TimingWheel(unsigned long long tick_us, const time_point &origin = std::chrono::steady_clock::now())
+            : tick(tick_us == 0 ? 1 : tick_us), origin(origin)
+        {
+        }
+
+        ~TimingWheel() {}
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        std::size_t size() const
+        {
+            return count;
+        }
+
+        std::chrono::microseconds resolution() const
+        {
+            return tick;
+        }
+
+        void insert(const _T &value, const time_point &tp)
+        {
+            uint64_t expire = tick_of(tp);
+            place(Entry{value, expire, expire});
+            count++;
+        }
+
+        void insert(_T &&value, const time_point &tp)
+        {
+            uint64_t expire = tick_of(tp);
+            place(Entry{std::move(value), expire, expire});
+            count++;
+        }
+
+        // moves every entry due at or before tp into due, in one pass.
+        void advance(const time_point &tp, std::vector<_T> &due)
+        {
+            if (tp < origin)
+            {
+                return;
+            }
+            uint64_t now_tick = std::chrono::duration_cast<std::chrono::microseconds>(tp - origin).count() / tick.count();
+            if (count == 0)
+            {
+                if (now_tick >= next_tick)
+                {
+                    next_tick = now_tick + 1;
+                }
+                return;
+            }
+            while (next_tick <= now_tick && count > 0)
+            {
+                std::size_t index = next_tick & SLOT_MASK;
+                for (std::size_t level = 1; index == 0 && level < LEVEL_COUNT; level++)
+                {
+                    index = cascade(level);
+                }
+                // swapped out, an entry placed again may land in a higher level slot
+                cascade_buffer.swap(slots[0][next_tick & SLOT_MASK]);
+                for (auto &&entry : cascade_buffer)
+                {
+                    if (entry.due_tick > next_tick)
+                    {
+                        place(std::move(entry));
+                    }
+                    else
+                    {
+                        due.push_back(std::move(entry.value));
+                        count--;
+                    }
+                }
+                cascade_buffer.clear();
+                next_tick++;
+            }
+            if (count == 0 && now_tick >= next_tick)
+            {
+                next_tick = now_tick + 1;
+            }
+        }
+
+        // drops every entry the predicate holds for, returns how many. O(n) over all slots.
+        template <class Pred>
+        std::size_t remove_if(Pred &&pred)
+        {
+            std::size_t removed = 0;
+            for (auto &&level : slots)
+            {
+                for (auto &&slot : level)
+                {
+                    auto end = std::remove_if(slot.begin(), slot.end(), [&pred](const Entry &e)
+                                              { return pred(e.value); });
+                    removed += slot.end() - end;
+                    slot.erase(end, slot.end());
+                }
+            }
+            count -= removed;
+            return removed;
+        }
+
+        // the time point at which advance() has to be called next.
+        // it is either the next expiry or a point where higher levels cascade down.
+        time_point next_expiry() const
+        {
+            if (count == 0)
+            {
+                return time_point::max();
+            }
+            uint64_t t = next_tick;
+            if ((t & SLOT_MASK) != 0)
+            {
+                uint64_t boundary = (t | SLOT_MASK) + 1;
+                while (t < boundary && slots[0][t & SLOT_MASK].empty())
+                {
+                    t++;
+                }
+            }
+            return origin + tick * static_cast<long long>(t);
+        }
+    };
+} // namespace stone
+
+#endif
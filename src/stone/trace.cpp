@@ -0,0 +1,210 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+namespace stone
+{
+    static std::mutex trace_mtx;
+    // every buffer a dump writes. buffers stay here after their thread exits until a dump
+    // or a clear covered their events, then they move to trace_free.
+    static std::vector<std::shared_ptr<TraceBuffer>> trace_buffers;
+    // buffers of exited threads not dumped yet, oldest first
+    static std::vector<std::shared_ptr<TraceBuffer>> trace_retired;
+    static std::vector<std::shared_ptr<TraceBuffer>> trace_free;
+    static uint32_t trace_next_tid = 1;
+    static std::unordered_set<std::string> trace_names;
+
+    // trace_mtx must be held
+    static void recycle(const std::shared_ptr<TraceBuffer> &buffer)
+    {
+        trace_buffers.erase(std::find(trace_buffers.begin(), trace_buffers.end(), buffer));
+        trace_free.push_back(buffer);
+    }
+
+    // trace_mtx must be held. moves the first count retired buffers to trace_free
+    static void recycle_retired(std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            recycle(trace_retired[i]);
+        }
+        trace_retired.erase(trace_retired.begin(), trace_retired.begin() + count);
+    }
+
+    // retires the thread's buffer when the thread exits
+    class TraceOwner
+    {
+    public:
+        std::shared_ptr<TraceBuffer> owned;
+
+        ~TraceOwner()
+        {
+            if (owned == nullptr)
+            {
+                return;
+            }
+            std::lock_guard<std::mutex> glock(trace_mtx);
+            trace_retired.push_back(std::move(owned));
+            if (trace_retired.size() > TRACE_RETIRED_BUFFERS)
+            {
+                recycle_retired(1);
+            }
+        }
+    };
+
+    TraceBuffer::TraceBuffer(std::size_t capacity, uint32_t tid, const std::string &thread_name)
+    {
+        std::size_t n = 1;
+        while (n < capacity)
+        {
+            n <<= 1;
+        }
+        this->capacity = n;
+        this->mask = n - 1;
+        this->slots.reset(new Slot[n]);
+        this->thread_id = tid;
+        this->thread_name = thread_name;
+    }
+
+    void TraceBuffer::reuse(uint32_t tid, const std::string &thread_name)
+    {
+        this->thread_id = tid;
+        this->thread_name = thread_name;
+        clear();
+    }
+
+    TraceBuffer &traceBuffer()
+    {
+        // the plain pointer keeps the fast path free of the owner's thread exit guard
+        static thread_local TraceBuffer *buffer = nullptr;
+        if (buffer == nullptr)
+        {
+            static thread_local TraceOwner owner;
+            std::string name;
+#ifdef __linux__
+            char text[16] = {};
+            if (pthread_getname_np(pthread_self(), text, sizeof(text)) == 0)
+            {
+                name = text;
+            }
+#endif
+            std::lock_guard<std::mutex> glock(trace_mtx);
+            // a dump still writing a free buffer holds another reference to it
+            auto it = std::find_if(trace_free.begin(), trace_free.end(), [](const std::shared_ptr<TraceBuffer> &b)
+                                   { return b.use_count() == 1; });
+            if (it != trace_free.end())
+            {
+                owner.owned = std::move(*it);
+                trace_free.erase(it);
+                owner.owned->reuse(trace_next_tid++, name);
+            }
+            else
+            {
+                owner.owned = std::make_shared<TraceBuffer>(TRACE_BUFFER_EVENTS, trace_next_tid++, name);
+            }
+            trace_buffers.push_back(owner.owned);
+            buffer = owner.owned.get();
+        }
+        return *buffer;
+    }
+
+    const char *traceName(const std::string &name)
+    {
+        std::lock_guard<std::mutex> glock(trace_mtx);
+        return trace_names.insert(name).first->c_str();
+    }
+
+#if STONE_TRACE_ENABLE
+    static void write_json_string(FILE *f, const char *text)
+    {
+        fputc('"', f);
+        for (const char *c = text; *c != '\0'; c++)
+        {
+            if (*c == '"' || *c == '\\')
+            {
+                fputc('\\', f);
+            }
+            if (static_cast<unsigned char>(*c) >= 0x20)
+            {
+                fputc(*c, f);
+            }
+        }
+        fputc('"', f);
+    }
+#endif
+
+    bool traceDump(const std::string &path)
+    {
+#if STONE_TRACE_ENABLE
+        std::vector<std::shared_ptr<TraceBuffer>> buffers;
+        std::vector<std::shared_ptr<TraceBuffer>> retired;
+        {
+            std::lock_guard<std::mutex> glock(trace_mtx);
+            buffers = trace_buffers;
+            retired = trace_retired;
+        }
+        FILE *f = fopen(path.c_str(), "w");
+        if (f == nullptr)
+        {
+            return false;
+        }
+        fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+        bool first = true;
+        for (auto &&b : buffers)
+        {
+            fprintf(f, "%s\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": ",
+                    first ? "" : ",", b->tid());
+            write_json_string(f, b->threadName().empty() ? "thread" : b->threadName().c_str());
+            fprintf(f, "}}");
+            first = false;
+            b->for_each([f, &b](const TraceBuffer::Event &e)
+                        {
+                            fprintf(f, ",\n{\"ph\": \"%c\", \"cat\": ", e.phase);
+                            write_json_string(f, e.cat);
+                            fprintf(f, ", \"name\": ");
+                            write_json_string(f, e.name);
+                            fprintf(f, ", \"ts\": %llu.%03llu, \"pid\": 1, \"tid\": %u",
+                                    (unsigned long long)(e.ts_ns / 1000), (unsigned long long)(e.ts_ns % 1000), b->tid());
+                            // instants are scoped to their thread
+                            fprintf(f, "%s, \"args\": {\"value\": %llu}}", e.phase == 'i' ? ", \"s\": \"t\"" : "",
+                                    (unsigned long long)e.arg); });
+        }
+        fprintf(f, "\n]}\n");
+        if (fclose(f) != 0)
+        {
+            return false;
+        }
+        // retired buffers do not change, the ones in this dump are exported
+        std::lock_guard<std::mutex> glock(trace_mtx);
+        std::size_t exported = 0;
+        while (exported < trace_retired.size() &&
+               std::find(retired.begin(), retired.end(), trace_retired[exported]) != retired.end())
+        {
+            exported++;
+        }
+        recycle_retired(exported);
+        return true;
+#else
+        (void)path;
+        return false;
+#endif
+    }
+
+    void traceClear()
+    {
+        std::lock_guard<std::mutex> glock(trace_mtx);
+        for (auto &&b : trace_buffers)
+        {
+            b->clear();
+        }
+        recycle_retired(trace_retired.size());
+    }
+} // namespace stone
@@ -0,0 +1,183 @@
+#ifndef STONE_TRACE_HPP
+#define STONE_TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "stoneconfig.hpp"
+
+namespace stone
+{
+    // Fixed ring of trace events written by one thread. The owner never waits: once the ring
+    // is full it overwrites its oldest events. A dump copies the ring while it is written and
+    // drops the events the owner overwrote during the copy.
+    // Event names must outlive the dump, use string literals or traceName().
+    class TraceBuffer
+    {
+    public:
+        class Event
+        {
+        public:
+            uint64_t ts_ns = 0;
+            const char *cat = nullptr;
+            const char *name = nullptr;
+            char phase = 0;
+            uint64_t arg = 0;
+        };
+
+        TraceBuffer(std::size_t capacity, uint32_t tid, const std::string &thread_name);
+
+        // hands the buffer of an exited thread to a new one, its old events are dropped
+        void reuse(uint32_t tid, const std::string &thread_name);
+
+        void record(char phase, const char *cat, const char *name, uint64_t arg)
+        {
+            uint64_t pos = head.load(std::memory_order_relaxed);
+            Slot &slot = slots[pos & mask];
+            slot.ts_ns.store(now_ns(), std::memory_order_relaxed);
+            slot.cat.store(cat, std::memory_order_relaxed);
+            slot.name.store(name, std::memory_order_relaxed);
+            slot.phase_arg.store((uint64_t(uint8_t(phase)) << 56) | (arg & ARG_MASK), std::memory_order_relaxed);
+            head.store(pos + 1, std::memory_order_release);
+        }
+
+        // calls fn for every event still in the ring, oldest first
+        template <class Fn>
+        void for_each(Fn &&fn) const
+        {
+            uint64_t end = head.load(std::memory_order_acquire);
+            uint64_t begin = end > capacity ? end - capacity : 0;
+            begin = std::max(begin, cleared.load(std::memory_order_relaxed));
+            for (uint64_t pos = begin; pos < end; pos++)
+            {
+                const Slot &slot = slots[pos & mask];
+                Event e;
+                e.ts_ns = slot.ts_ns.load(std::memory_order_relaxed);
+                e.cat = slot.cat.load(std::memory_order_relaxed);
+                e.name = slot.name.load(std::memory_order_relaxed);
+                uint64_t phase_arg = slot.phase_arg.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                // the owner went round and may have rewritten the slot meanwhile. at head - pos ==
+                // capacity it may be rewriting it right now, head only moves once the slot is written
+                if (head.load(std::memory_order_relaxed) - pos >= capacity)
+                {
+                    continue;
+                }
+                e.phase = char(phase_arg >> 56);
+                e.arg = phase_arg & ARG_MASK;
+                fn(e);
+            }
+        }
+
+        void clear()
+        {
+            cleared.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        uint32_t tid() const
+        {
+            return this->thread_id;
+        }
+
+        const std::string &threadName() const
+        {
+            return this->thread_name;
+        }
+
+        static uint64_t now_ns()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+    private:
+        static constexpr uint64_t ARG_MASK = (uint64_t(1) << 56) - 1;
+
+        class Slot
+        {
+        public:
+            std::atomic<uint64_t> ts_ns{0};
+            std::atomic<const char *> cat{nullptr};
+            std::atomic<const char *> name{nullptr};
+            // phase in the top byte
+            std::atomic<uint64_t> phase_arg{0};
+        };
+
+        std::size_t capacity;
+        std::size_t mask;
+        std::unique_ptr<Slot[]> slots;
+        uint32_t thread_id;
+        std::string thread_name;
+        std::atomic<uint64_t> cleared{0};
+        alignas(64) std::atomic<uint64_t> head{0};
+    };
+
+    // the calling thread's buffer, registered on first use. when the thread exits the buffer
+    // is kept for the next dump and then reused by another thread.
+    TraceBuffer &traceBuffer();
+
+    // a copy of the name that lives until the program exits, the same pointer for equal names
+    const char *traceName(const std::string &name);
+
+    // writes every buffered event as Chrome trace event JSON, which Perfetto also reads.
+    // returns false if tracing is compiled out or the file cannot be written.
+    bool traceDump(const std::string &path);
+
+    // forgets the events recorded so far
+    void traceClear();
+
+    inline void traceBegin(const char *cat, const char *name, uint64_t arg = 0)
+    {
+        traceBuffer().record('B', cat, name, arg);
+    }
+
+    inline void traceEnd(const char *cat, const char *name, uint64_t arg = 0)
+    {
+        traceBuffer().record('E', cat, name, arg);
+    }
+
+    inline void traceInstant(const char *cat, const char *name, uint64_t arg = 0)
+    {
+        traceBuffer().record('i', cat, name, arg);
+    }
+
+    class TraceScope
+    {
+    public:
+        TraceScope(const char *cat, const char *name) : cat(cat), name(name)
+        {
+            traceBegin(cat, name);
+        }
+        ~TraceScope()
+        {
+            traceEnd(cat, name);
+        }
+
+    private:
+        const char *cat;
+        const char *name;
+    };
+
+} // namespace stone
+
+// the hooks of the framework use these, they compile to nothing unless STONE_TRACE_ENABLE is set
+#if STONE_TRACE_ENABLE
+#define STONE_TRACE_BEGIN(cat, name, arg) stone::traceBegin(cat, name, arg)
+#define STONE_TRACE_END(cat, name, arg) stone::traceEnd(cat, name, arg)
+#define STONE_TRACE_INSTANT(cat, name, arg) stone::traceInstant(cat, name, arg)
+#define STONE_TRACE_CONCAT_(a, b) a##b
+#define STONE_TRACE_CONCAT(a, b) STONE_TRACE_CONCAT_(a, b)
+#define STONE_TRACE_SCOPE(cat, name) stone::TraceScope STONE_TRACE_CONCAT(stone_trace_scope_, __LINE__)(cat, name)
+#else
+#define STONE_TRACE_BEGIN(cat, name, arg) ((void)0)
+#define STONE_TRACE_END(cat, name, arg) ((void)0)
+#define STONE_TRACE_INSTANT(cat, name, arg) ((void)0)
+#define STONE_TRACE_SCOPE(cat, name) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,87 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+// every heap allocation of the benchmark executable goes through here
+static std::atomic<std::size_t> allocations{0};
+
+void *operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static void wait_done(const std::atomic<std::size_t> &done, std::size_t expected)
+{
+    while (done.load() < expected)
+    {
+        std::this_thread::yield();
+    }
+}
+
+// returns allocations per task, measured after a warm-up round.
+template <class Submit>
+static double allocations_per_task(Submit &&submit, std::size_t count)
+{
+    std::atomic<std::size_t> done{0};
+    for (std::size_t i = 0; i < count; i++)
+    {
+        submit(done);
+    }
+    wait_done(done, count);
+
+    done = 0;
+    std::size_t before = allocations.load();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        submit(done);
+    }
+    wait_done(done, count);
+    return double(allocations.load() - before) / count;
+}
+
+void bench_alloc()
+{
+    stone::ThreadPool pool(2);
+    const std::size_t count = 10000;
+    uint64_t a = 1, b = 2, c = 3;
+
+    double once_task = allocations_per_task([&](std::atomic<std::size_t> &done)
+                                            {
+                                                auto [task, future] = stone::make_once_task([&done, a, b, c]()
+                                                                                            { done += (a + b + c) > 0; });
+                                                pool.push(task); },
+                                            count);
+    double work_item = allocations_per_task([&](std::atomic<std::size_t> &done)
+                                            {
+                                                auto task = std::make_shared<stone::WorkItem>();
+                                                task->fn = [&done, a, b, c]()
+                                                { done += (a + b + c) > 0; };
+                                                pool.push(task); },
+                                            count);
+    double submit = allocations_per_task([&](std::atomic<std::size_t> &done)
+                                         { pool.submit([&done, a, b, c]()
+                                                       { done += (a + b + c) > 0; }); },
+                                         count);
+    // the tasks capture 32 bytes
+    bench_report("task_allocations", {{"api", "make_once_task"}}, "allocations", once_task, "per task");
+    bench_report("task_allocations", {{"api", "make_shared_work_item"}}, "allocations", work_item, "per task");
+    bench_report("task_allocations", {{"api", "submit"}}, "allocations", submit, "per task");
+}
@@ -0,0 +1,85 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <cstdio>
+#include <thread>
+
+#ifdef STONE_HAS_COROUTINES
+
+struct stamp_t
+{
+    std::chrono::steady_clock::time_point sent;
+};
+
+// waits for count messages and records how long each one took from publish to resume
+static stone::task<> receive_loop(stone::awaitable_subscriber<stamp_t> *sub, std::size_t count,
+                                  stone::LatencyHistogram *latency)
+{
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto msg = co_await sub->next();
+        latency->record(stone::elapsed_ns(msg->sent, stone::timepoint_now()));
+    }
+}
+
+// sleeps count times and records how late each resume is
+static stone::task<> sleep_loop(stone::Scheduler *scheduler, unsigned long long us, std::size_t count,
+                                stone::LatencyHistogram *lateness)
+{
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto due = stone::timepoint_shift(us);
+        co_await stone::sleep_until(due, scheduler);
+        lateness->record(stone::elapsed_ns(due, stone::timepoint_now()));
+    }
+}
+
+static void topic_resume(std::size_t count)
+{
+    stone::ThreadPool pool(2);
+    auto sub = stone::subscribe_awaitable<stamp_t>("bench_coroutine", 64);
+    auto topic = stone::advertise<stamp_t>("bench_coroutine");
+    stone::LatencyHistogram latency;
+    auto done = stone::spawn(receive_loop(sub, count, &latency), &pool);
+    while (done.wait_for(std::chrono::microseconds(200)) != std::future_status::ready)
+    {
+        auto msg = std::make_shared<stamp_t>();
+        msg->sent = stone::timepoint_now();
+        stone::publish(topic, msg);
+    }
+    stone::unsubscribe(sub);
+    delete sub;
+    pool.shutdown();
+    bench_report("topic_resume", {{"messages", std::to_string(count)}}, "latency", latency);
+}
+
+static void sleep_resume(stone::Scheduler::TimerBackend backend, unsigned long long us, std::size_t count)
+{
+    stone::ThreadPool pool(2);
+    stone::Scheduler scheduler(&pool, backend);
+    std::thread th([&scheduler]()
+                   { scheduler.run(); });
+    stone::LatencyHistogram lateness;
+    stone::spawn(sleep_loop(&scheduler, us, count, &lateness), &pool).wait();
+    scheduler.shutdown();
+    th.join();
+    pool.shutdown();
+    bench_params params = {{"backend", backend == stone::Scheduler::TimerBackend::HEAP ? "heap" : "wheel"},
+                           {"sleep_us", std::to_string(us)}};
+    bench_report("sleep_resume", params, "lateness", lateness);
+}
+
+void bench_coroutine()
+{
+    topic_resume(2000);
+    sleep_resume(stone::Scheduler::TimerBackend::HEAP, 1_ms, 500);
+    sleep_resume(stone::Scheduler::TimerBackend::WHEEL, 1_ms, 500);
+}
+
+#else
+
+void bench_coroutine()
+{
+    printf("coroutine benchmarks need a build with -DSTONE_CXX20=ON\r\n");
+}
+
+#endif
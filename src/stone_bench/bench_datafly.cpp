@@ -0,0 +1,422 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <queue>
+#include <thread>
+
+struct bench_msg_t
+{
+    uint64_t seq;
+    double values[8];
+};
+
+// the mutex protected queue the subscribers used before the lock-free ring
+class LockedQueue
+{
+private:
+    std::mutex mtx;
+    std::queue<std::shared_ptr<bench_msg_t>> msgs;
+    std::size_t max_size;
+
+public:
+    LockedQueue(std::size_t max_size) : max_size(max_size) {}
+
+    bool push(const std::shared_ptr<bench_msg_t> &msg)
+    {
+        std::lock_guard<std::mutex> glock(mtx);
+        if (msgs.size() >= max_size)
+        {
+            return false;
+        }
+        msgs.push(msg);
+        return true;
+    }
+
+    bool pop(std::shared_ptr<bench_msg_t> &msg)
+    {
+        std::lock_guard<std::mutex> glock(mtx);
+        if (msgs.empty())
+        {
+            return false;
+        }
+        msg = msgs.front();
+        msgs.pop();
+        return true;
+    }
+};
+
+// push and pop one message at a time on one thread, returns ns per message.
+template <class Queue>
+static double queue_roundtrip(Queue &queue, std::size_t count)
+{
+    auto msg = std::make_shared<bench_msg_t>();
+    std::shared_ptr<bench_msg_t> out;
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        queue.push(msg);
+        queue.pop(out);
+    }
+    return bench_elapsed_sec(t0) * 1e9 / count;
+}
+
+// publishers on their own threads, one subscriber spinning on the main thread.
+// returns delivered messages per second.
+static double publish_throughput(std::size_t publishers, std::size_t count, bool single_publisher,
+                                 std::size_t &dropped)
+{
+    std::string topic = "bench_throughput_" + std::to_string(publishers) + (single_publisher ? "_s" : "_m");
+    std::atomic<std::size_t> received{0};
+    auto sub = stone::subscribe<bench_msg_t>(topic, [&received](const std::shared_ptr<bench_msg_t> &)
+                                             { received++; },
+                                             1024, single_publisher);
+    auto msg = std::make_shared<bench_msg_t>();
+    std::atomic<std::size_t> finished{0};
+    std::vector<std::thread> threads;
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t p = 0; p < publishers; p++)
+    {
+        threads.push_back(std::thread([&, p]()
+                                      {
+                                          for (std::size_t i = 0; i < count; i++)
+                                          {
+                                              stone::publish(topic, msg);
+                                          }
+                                          finished++; }));
+    }
+    while (finished < publishers)
+    {
+        sub->spin();
+    }
+    for (auto &&t : threads)
+    {
+        t.join();
+    }
+    while (true)
+    {
+        std::size_t before = received;
+        sub->spin();
+        if (received == before)
+        {
+            break;
+        }
+    }
+    double rate = received / bench_elapsed_sec(t0);
+    dropped = publishers * count - received;
+    stone::unsubscribe(sub);
+    return rate;
+}
+
+// every publisher thread publishes to its own topic, or all of them to one shared topic.
+// every topic has the given number of subscribers, returns ns per publish.
+static double publish_fanout(std::size_t publishers, std::size_t subscribers, bool shared_topic,
+                             bool use_handle, std::size_t count)
+{
+    std::vector<std::string> topics;
+    std::vector<stone::subscriber<bench_msg_t> *> subs;
+    std::string prefix = "bench_fanout_" + std::to_string(publishers) + "_" + std::to_string(subscribers) +
+                         (shared_topic ? "_shared_" : "_own_") + (use_handle ? "h_" : "s_");
+    for (std::size_t p = 0; p < (shared_topic ? 1 : publishers); p++)
+    {
+        topics.push_back(prefix + std::to_string(p));
+        for (std::size_t s = 0; s < subscribers; s++)
+        {
+            subs.push_back(stone::subscribe<bench_msg_t>(topics.back(), [](const std::shared_ptr<bench_msg_t> &) {}, 64));
+        }
+    }
+    // keep the queues from filling up, a full queue is cheaper than a real push
+    std::atomic<bool> draining{true};
+    std::thread drainer([&]()
+                        {
+                            while (draining)
+                            {
+                                for (auto &&s : subs)
+                                {
+                                    s->spin();
+                                }
+                            } });
+
+    auto msg = std::make_shared<bench_msg_t>();
+    std::vector<std::thread> threads;
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t p = 0; p < publishers; p++)
+    {
+        const std::string &topic = topics[shared_topic ? 0 : p];
+        threads.push_back(std::thread([&, topic]()
+                                      {
+                                          auto handle = stone::advertise<bench_msg_t>(topic);
+                                          for (std::size_t i = 0; i < count; i++)
+                                          {
+                                              if (use_handle)
+                                              {
+                                                  stone::publish(handle, msg);
+                                              }
+                                              else
+                                              {
+                                                  stone::publish(topic, msg);
+                                              }
+                                          } }));
+    }
+    for (auto &&t : threads)
+    {
+        t.join();
+    }
+    double ns = bench_elapsed_sec(t0) * 1e9 / (publishers * count);
+    draining = false;
+    drainer.join();
+    for (auto &&s : subs)
+    {
+        stone::unsubscribe(s);
+    }
+    return ns;
+}
+
+constexpr stone::Topic<bench_msg_t> BENCH_LOOKUP_TOPIC{0, "bench_lookup"};
+
+// publishes to one topic with one subscriber and takes the message back right away, the
+// topic is named by a string, an advertised handle or a compile-time Topic. returns ns per
+// message.
+static double topic_lookup(const std::string &lookup, std::size_t count)
+{
+    auto sub = stone::subscribe(BENCH_LOOKUP_TOPIC, [](const std::shared_ptr<bench_msg_t> &) {});
+    auto handle = stone::advertise(BENCH_LOOKUP_TOPIC);
+    const std::string name = BENCH_LOOKUP_TOPIC.name;
+    auto msg = std::make_shared<bench_msg_t>();
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (lookup == "string")
+        {
+            stone::publish(name, msg);
+        }
+        else if (lookup == "handle")
+        {
+            stone::publish(handle, msg);
+        }
+        else
+        {
+            stone::publish(BENCH_LOOKUP_TOPIC, msg);
+        }
+        sub->spin();
+    }
+    double ns = bench_elapsed_sec(t0) * 1e9 / count;
+    stone::unsubscribe(sub);
+    return ns;
+}
+
+struct bench_frame_t
+{
+    uint64_t seq;
+    unsigned char pixels[640 * 480];
+};
+
+// publish and consume one frame at a time, returns ns per frame.
+static double frame_publish(bool loaned, std::size_t count)
+{
+    auto topic = stone::advertise<bench_frame_t>(loaned ? "bench_frame_loaned" : "bench_frame_heap", loaned ? 8 : 0);
+    auto sub = stone::subscribe<bench_frame_t>(topic.name(), [](const std::shared_ptr<bench_frame_t> &) {}, 4);
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto frame = loaned ? topic.loan() : std::make_shared<bench_frame_t>();
+        frame->seq = i;
+        frame->pixels[i % sizeof(frame->pixels)] = 1;
+        stone::publish(topic, frame);
+        sub->spin();
+    }
+    double ns = bench_elapsed_sec(t0) * 1e9 / count;
+    stone::unsubscribe(sub);
+    return ns;
+}
+
+// publishes bursts of messages and waits until the subscriber handled all of them.
+// event: the publisher also emits an event and an event task calls spin(), like example_sub.
+// executor: the subscription dispatches its callback by itself.
+static void callback_dispatch(bool executor, std::size_t burst, std::size_t rounds)
+{
+    stone::ThreadPool pool(2);
+    stone::Scheduler scheduler(&pool);
+    const std::string topic = std::string("bench_dispatch_") + (executor ? "executor_" : "event_") + std::to_string(burst);
+    stone::LatencyHistogram latency;
+    std::atomic<std::size_t> received{0};
+    std::size_t stranded = 0;
+    std::chrono::steady_clock::time_point published;
+    auto cb = [&](const std::shared_ptr<bench_msg_t> &)
+    {
+        latency.record(stone::elapsed_ns(published, stone::timepoint_now()));
+        received++;
+    };
+    stone::subscriber<bench_msg_t> *sub = nullptr;
+    std::shared_ptr<stone::WorkItem> task;
+    stone::EventId event = stone::INVALID_EVENT;
+    if (executor)
+    {
+        stone::executor_options options;
+        options.pool = &pool;
+        sub = stone::subscribe<bench_msg_t>(topic, cb, options, 64);
+    }
+    else
+    {
+        sub = stone::subscribe<bench_msg_t>(topic, cb, 64);
+        event = scheduler.registerEvent(topic);
+        task = stone::make_event_task([&sub]()
+                                      { sub->spin(); });
+        scheduler.scheduleEvent(task, event);
+    }
+    auto handle = stone::advertise<bench_msg_t>(topic);
+    auto msg = std::make_shared<bench_msg_t>();
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; r++)
+    {
+        std::size_t expected = received.load() + burst;
+        published = stone::timepoint_now();
+        for (std::size_t i = 0; i < burst; i++)
+        {
+            stone::publish(handle, msg);
+            if (!executor)
+            {
+                scheduler.emitEvent(event);
+            }
+        }
+        // an emit that finds the event task running is lost, its message stays queued
+        // until the next emit. fetch such stranded messages after a while.
+        auto give_up = std::chrono::steady_clock::now() + std::chrono::milliseconds(2);
+        while (received.load() < expected)
+        {
+            if (!executor && std::chrono::steady_clock::now() > give_up)
+            {
+                stranded += sub->spin_some(burst);
+            }
+            std::this_thread::yield();
+        }
+    }
+    double rate = rounds * burst / bench_elapsed_sec(t0);
+    stone::unsubscribe(sub);
+    bench_params params = {{"dispatch", executor ? "executor" : "event"}, {"burst", std::to_string(burst)}};
+    bench_report("callback_dispatch", params, "throughput", rate, "msg/s");
+    bench_report("callback_dispatch", params, "stranded", double(stranded), "msg");
+    bench_report("callback_dispatch", params, "latency", latency);
+}
+
+struct bench_pose_t
+{
+    uint64_t seq;
+    double position[3];
+    double orientation[4];
+};
+
+// one thread publishes poses while another keeps reading the newest one.
+// every field of a pose holds its sequence number, so a torn copy would be noticed.
+static void latest_mailbox(std::size_t count)
+{
+    auto topic = stone::advertise<bench_pose_t>("bench_latest_pose");
+    auto sub = stone::subscribe_latest<bench_pose_t>(topic.name());
+    std::atomic<bool> writing{true};
+    std::size_t reads = 0, torn = 0;
+    double read_sec = 0;
+    std::thread reader([&]()
+                       {
+                           auto t0 = std::chrono::steady_clock::now();
+                           bench_pose_t pose;
+                           while (writing.load(std::memory_order_relaxed))
+                           {
+                               if (sub->read(pose) == 0)
+                               {
+                                   continue;
+                               }
+                               reads++;
+                               for (double v : pose.position)
+                               {
+                                   torn += (v != double(pose.seq));
+                               }
+                           }
+                           read_sec = bench_elapsed_sec(t0); });
+    auto msg = std::make_shared<bench_pose_t>();
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 1; i <= count; i++)
+    {
+        msg->seq = i;
+        msg->position[0] = msg->position[1] = msg->position[2] = double(i);
+        stone::publish(topic, msg);
+    }
+    double write_ns = bench_elapsed_sec(t0) * 1e9 / count;
+    writing = false;
+    reader.join();
+    stone::unsubscribe(sub);
+    bench_report("latest_mailbox", {{"bytes", std::to_string(sizeof(bench_pose_t))}}, "publish", write_ns, "ns");
+    bench_report("latest_mailbox", {{"bytes", std::to_string(sizeof(bench_pose_t))}}, "read", reads ? read_sec * 1e9 / reads : 0, "ns");
+    bench_report("latest_mailbox", {{"bytes", std::to_string(sizeof(bench_pose_t))}}, "torn", double(torn), "reads");
+}
+
+void bench_datafly()
+{
+    LockedQueue locked(1024);
+    stone::BoundedRing<std::shared_ptr<bench_msg_t>> ring(1024);
+    bench_report("queue_roundtrip", {{"queue", "mutex"}}, "cost", queue_roundtrip(locked, 1000000), "ns");
+    bench_report("queue_roundtrip", {{"queue", "ring"}}, "cost", queue_roundtrip(ring, 1000000), "ns");
+
+    for (std::size_t publishers : {1, 2, 4})
+    {
+        for (bool single : {true, false})
+        {
+            if (single && publishers > 1)
+            {
+                continue;
+            }
+            std::size_t dropped = 0;
+            double rate = publish_throughput(publishers, 200000, single, dropped);
+            bench_params params = {{"publishers", std::to_string(publishers)}, {"mode", single ? "spsc" : "mpsc"}};
+            bench_report("publish_throughput", params, "delivered", rate, "msg/s");
+            bench_report("publish_throughput", params, "dropped", double(dropped), "msg");
+        }
+    }
+
+    bench_report("frame_publish", {{"alloc", "make_shared"}}, "cost", frame_publish(false, 20000), "ns");
+    bench_report("frame_publish", {{"alloc", "loan"}}, "cost", frame_publish(true, 20000), "ns");
+
+    // a subscriber that never spins holds on to its queue, the pool runs dry
+    auto pool_topic = stone::advertise<bench_frame_t>("bench_frame_exhaust", 8);
+    auto idle_sub = stone::subscribe<bench_frame_t>(pool_topic.name(), [](const std::shared_ptr<bench_frame_t> &) {}, 16);
+    for (int i = 0; i < 16; i++)
+    {
+        auto frame = pool_topic.loan();
+        if (frame != nullptr)
+        {
+            stone::publish(pool_topic, frame);
+        }
+    }
+    auto stats = pool_topic.pool()->stats();
+    bench_params pool_params = {{"capacity", std::to_string(stats.capacity)}};
+    bench_report("pool_exhausted", pool_params, "in_use", double(stats.in_use), "msg");
+    bench_report("pool_exhausted", pool_params, "loans", double(stats.loans), "msg");
+    bench_report("pool_exhausted", pool_params, "exhausted", double(stats.exhausted), "msg");
+    stone::unsubscribe(idle_sub);
+
+    for (std::size_t publishers : {1, 4})
+    {
+        for (std::size_t subscribers : {1, 4, 16, 64})
+        {
+            for (bool shared : {false, true})
+            {
+                bench_params params = {{"publishers", std::to_string(publishers)},
+                                       {"subscribers", std::to_string(subscribers)},
+                                       {"topics", shared ? "shared" : "own"}};
+                params.push_back({"lookup", "string"});
+                bench_report("publish_fanout", params, "cost", publish_fanout(publishers, subscribers, shared, false, 20000), "ns/msg");
+                params.back().second = "handle";
+                bench_report("publish_fanout", params, "cost", publish_fanout(publishers, subscribers, shared, true, 20000), "ns/msg");
+            }
+        }
+    }
+
+    for (const char *lookup : {"string", "handle", "static"})
+    {
+        bench_report("topic_lookup", {{"lookup", lookup}}, "cost", topic_lookup(lookup, 1000000), "ns/msg");
+    }
+
+    for (std::size_t burst : {1, 8})
+    {
+        callback_dispatch(false, burst, 5000);
+        callback_dispatch(true, burst, 5000);
+    }
+    latest_mailbox(2000000);
+}
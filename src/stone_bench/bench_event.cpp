@@ -0,0 +1,99 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <thread>
+
+// emits an event nobody waits for, returns ns per emit.
+static double emit_empty(stone::Scheduler &scheduler, bool by_id, std::size_t count)
+{
+    const std::string name = "bench_event_empty";
+    stone::EventId id = scheduler.registerEvent(name);
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (by_id)
+        {
+            scheduler.emitEvent(id);
+        }
+        else
+        {
+            scheduler.emitEvent(name);
+        }
+    }
+    return bench_elapsed_sec(t0) * 1e9 / count;
+}
+
+// emits an event with waiters and waits until every waiter ran and waits again.
+// returns ns per round trip.
+static double emit_roundtrip(stone::Scheduler &scheduler, std::size_t waiters, bool by_id, std::size_t count)
+{
+    const std::string name = "bench_event_" + std::to_string(waiters) + (by_id ? "_id" : "_name");
+    stone::EventId id = scheduler.registerEvent(name);
+    std::vector<std::shared_ptr<stone::WorkItem>> tasks;
+    for (std::size_t i = 0; i < waiters; i++)
+    {
+        auto task = stone::make_event_task([]() {});
+        scheduler.scheduleEvent(task, id);
+        tasks.push_back(task);
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (by_id)
+        {
+            scheduler.emitEvent(id);
+        }
+        else
+        {
+            scheduler.emitEvent(name);
+        }
+        while (scheduler.eventWaiters(id) < waiters)
+        {
+            std::this_thread::yield();
+        }
+    }
+    return bench_elapsed_sec(t0) * 1e9 / count;
+}
+
+// time from emitEvent to the start of each waiter.
+static void wakeup_latency(stone::Scheduler &scheduler, std::size_t waiters, std::size_t count)
+{
+    const std::string name = "bench_event_wakeup_" + std::to_string(waiters);
+    stone::EventId id = scheduler.registerEvent(name);
+    stone::LatencyHistogram histogram;
+    // written before emitting, the pool's queue publishes it to the waiters
+    std::chrono::steady_clock::time_point emitted;
+    std::vector<std::shared_ptr<stone::WorkItem>> tasks;
+    for (std::size_t i = 0; i < waiters; i++)
+    {
+        auto task = stone::make_event_task([&histogram, &emitted]()
+                                           { histogram.record(stone::elapsed_ns(emitted, stone::timepoint_now())); });
+        scheduler.scheduleEvent(task, id);
+        tasks.push_back(task);
+    }
+    for (std::size_t i = 0; i < count; i++)
+    {
+        emitted = stone::timepoint_now();
+        scheduler.emitEvent(id);
+        while (scheduler.eventWaiters(id) < waiters)
+        {
+            std::this_thread::yield();
+        }
+    }
+    bench_report("emit_wakeup", {{"waiters", std::to_string(waiters)}}, "latency", histogram);
+}
+
+void bench_event()
+{
+    stone::ThreadPool pool(2);
+    stone::Scheduler scheduler(&pool);
+    bench_report("emit_empty", {{"lookup", "name"}}, "cost", emit_empty(scheduler, false, 1000000), "ns/emit");
+    bench_report("emit_empty", {{"lookup", "id"}}, "cost", emit_empty(scheduler, true, 1000000), "ns/emit");
+    for (std::size_t waiters : {1, 8, 64})
+    {
+        bench_report("emit_roundtrip", {{"waiters", std::to_string(waiters)}, {"lookup", "name"}}, "cost",
+                     emit_roundtrip(scheduler, waiters, false, 20000), "ns/emit");
+        bench_report("emit_roundtrip", {{"waiters", std::to_string(waiters)}, {"lookup", "id"}}, "cost",
+                     emit_roundtrip(scheduler, waiters, true, 20000), "ns/emit");
+        wakeup_latency(scheduler, waiters, 5000);
+    }
+}
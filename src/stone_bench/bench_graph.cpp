@@ -0,0 +1,117 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+
+// a perception-like frame: `stages` levels of `width` tasks,
+// every task depends on two tasks of the previous level.
+static const std::size_t stages = 4;
+static const std::size_t width = 8;
+
+static void frame_work(std::atomic<std::size_t> &counter)
+{
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+// builds and schedules a WorkItemFlow every frame, returns frames per second.
+// completion records the time from scheduleNow until the last level is done.
+static double flow_rebuild(stone::Scheduler &scheduler, std::size_t frames, stone::LatencyHistogram &completion)
+{
+    std::atomic<std::size_t> counter{0};
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t f = 0; f < frames; f++)
+    {
+        stone::WorkItemFlow flow(stages);
+        std::vector<std::future<void>> last;
+        for (std::size_t s = 0; s < stages; s++)
+        {
+            for (std::size_t w = 0; w < width; w++)
+            {
+                auto [task, future] = stone::make_once_task(frame_work, std::ref(counter));
+                flow.add(s, task);
+                if (s == stages - 1)
+                {
+                    last.push_back(std::move(future));
+                }
+            }
+        }
+        flow.finish();
+        auto start = stone::timepoint_now();
+        scheduler.scheduleNow(flow);
+        for (auto &&future : last)
+        {
+            future.wait();
+        }
+        completion.record(stone::elapsed_ns(start, stone::timepoint_now()));
+    }
+    return frames / bench_elapsed_sec(t0);
+}
+
+// builds a TaskGraph once and launches it every frame, returns frames per second.
+static double graph_relaunch(stone::ThreadPool &pool, std::size_t frames, stone::LatencyHistogram &completion)
+{
+    std::atomic<std::size_t> counter{0};
+    stone::TaskGraph graph;
+    std::vector<stone::TaskGraph::node_id> ids;
+    for (std::size_t s = 0; s < stages; s++)
+    {
+        for (std::size_t w = 0; w < width; w++)
+        {
+            ids.push_back(graph.add(frame_work, std::ref(counter)));
+            if (s > 0)
+            {
+                graph.precede(ids[(s - 1) * width + w], ids.back());
+                graph.precede(ids[(s - 1) * width + (w + 1) % width], ids.back());
+            }
+        }
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t f = 0; f < frames; f++)
+    {
+        auto start = stone::timepoint_now();
+        graph.launch(&pool);
+        graph.wait();
+        completion.record(stone::elapsed_ns(start, stone::timepoint_now()));
+    }
+    return frames / bench_elapsed_sec(t0);
+}
+
+// a flow with one wide level joined by a single task. reports how long scheduleNow takes
+// and how long until the join task ran.
+static void flow_launch(stone::Scheduler &scheduler, std::size_t wide, std::size_t frames)
+{
+    stone::LatencyHistogram launch, completion;
+    std::atomic<std::size_t> counter{0};
+    for (std::size_t f = 0; f < frames; f++)
+    {
+        stone::WorkItemFlow flow(2);
+        for (std::size_t w = 0; w < wide; w++)
+        {
+            auto [task, future] = stone::make_once_task(frame_work, std::ref(counter));
+            flow.add(0, task);
+        }
+        auto [join, joined] = stone::make_once_task(frame_work, std::ref(counter));
+        flow.add(1, join);
+        flow.finish();
+        auto start = stone::timepoint_now();
+        scheduler.scheduleNow(flow);
+        launch.record(stone::elapsed_ns(start, stone::timepoint_now()));
+        joined.wait();
+        completion.record(stone::elapsed_ns(start, stone::timepoint_now()));
+    }
+    const bench_params params = {{"width", std::to_string(wide)}};
+    bench_report("flow_launch", params, "schedule", launch);
+    bench_report("flow_launch", params, "completion", completion);
+}
+
+void bench_graph()
+{
+    stone::ThreadPool pool(4);
+    stone::Scheduler scheduler(&pool);
+    const bench_params params = {{"stages", std::to_string(stages)}, {"width", std::to_string(width)}};
+    stone::LatencyHistogram flow_completion;
+    bench_report("flow_rebuild", params, "throughput", flow_rebuild(scheduler, 20000, flow_completion), "frames/s");
+    bench_report("flow_rebuild", params, "completion", flow_completion);
+    stone::LatencyHistogram graph_completion;
+    bench_report("graph_relaunch", params, "throughput", graph_relaunch(pool, 20000, graph_completion), "frames/s");
+    bench_report("graph_relaunch", params, "completion", graph_completion);
+    flow_launch(scheduler, 200, 2000);
+}
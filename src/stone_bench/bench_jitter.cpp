@@ -0,0 +1,48 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <ctime>
+#include <thread>
+
+// cpu time used by the calling thread
+static double thread_cpu_sec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// runs one interval task for a while and reports its instrumentation.
+static void interval_jitter(stone::Scheduler::TimerBackend backend, unsigned long long interval_us,
+                            std::chrono::milliseconds duration)
+{
+    stone::ThreadPool pool(2);
+    stone::Scheduler scheduler(&pool, backend);
+    double scheduler_cpu = 0;
+    std::thread th([&scheduler, &scheduler_cpu]()
+                   {
+                       scheduler.run();
+                       scheduler_cpu = thread_cpu_sec(); });
+    auto task = stone::make_interval_task([]() {});
+    auto stats = task->enable_stats();
+    scheduler.scheduleInterval(task, interval_us);
+    std::this_thread::sleep_for(duration);
+    scheduler.shutdown();
+    th.join();
+    pool.shutdown();
+
+    bench_params params = {{"backend", backend == stone::Scheduler::TimerBackend::HEAP ? "heap" : "wheel"},
+                           {"interval_us", std::to_string(interval_us)}};
+    bench_report("interval_jitter", params, "lateness", stats->lateness);
+    bench_report("interval_jitter", params, "queued", stats->queued);
+    bench_report("interval_jitter", params, "execution", stats->execution);
+    bench_report("interval_jitter", params, "scheduler_cpu", 100.0 * scheduler_cpu / (duration.count() * 1e-3), "%");
+}
+
+void bench_jitter()
+{
+    for (unsigned long long interval_us : {100_us, 1_ms, 10_ms})
+    {
+        interval_jitter(stone::Scheduler::TimerBackend::HEAP, interval_us, std::chrono::milliseconds(1000));
+        interval_jitter(stone::Scheduler::TimerBackend::WHEEL, interval_us, std::chrono::milliseconds(1000));
+    }
+}
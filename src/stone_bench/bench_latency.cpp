@@ -0,0 +1,49 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <thread>
+
+// time from scheduleNow until the task starts and until scheduleNow sees it done.
+static void schedule_latency(std::size_t workers, std::size_t count)
+{
+    stone::ThreadPool pool(workers);
+    stone::Scheduler scheduler(&pool);
+    stone::LatencyHistogram start_latency, done_latency;
+    std::chrono::steady_clock::time_point scheduled;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto [task, future] = stone::make_once_task([&start_latency, &scheduled]()
+                                                    { start_latency.record(stone::elapsed_ns(scheduled, stone::timepoint_now())); });
+        scheduled = stone::timepoint_now();
+        scheduler.scheduleNow(task);
+        future.wait();
+        done_latency.record(stone::elapsed_ns(scheduled, stone::timepoint_now()));
+    }
+    bench_params params = {{"workers", std::to_string(workers)}};
+    bench_report("schedule_now", params, "start", start_latency);
+    bench_report("schedule_now", params, "done", done_latency);
+}
+
+#if STONE_TRACE_ENABLE
+// cost of one trace event on the recording thread
+static void trace_cost(std::size_t count)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        stone::traceInstant("bench", "event", i);
+    }
+    bench_report("trace_event", {}, "cost", bench_elapsed_sec(t0) * 1e9 / count, "ns");
+}
+#endif
+
+void bench_latency()
+{
+    for (std::size_t workers : {1, 4})
+    {
+        schedule_latency(workers, 20000);
+    }
+#if STONE_TRACE_ENABLE
+    trace_cost(1000000);
+    stone::traceClear();
+#endif
+}
@@ -0,0 +1,114 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <cmath>
+
+// a point cloud filter: every point costs a few flops
+static void filter_points(std::vector<float> &points, std::size_t begin, std::size_t end)
+{
+    for (std::size_t i = begin; i < end; i++)
+    {
+        points[i] = std::sqrt(points[i] * points[i] + 1.0f) * 0.5f;
+    }
+}
+
+// one make_once_task per chunk and a future for each, what callers did before parallel_for
+static double per_chunk_tasks(stone::ThreadPool &pool, std::vector<float> &points, std::size_t grain, std::size_t rounds)
+{
+    std::vector<std::future<void>> futures;
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; r++)
+    {
+        for (std::size_t begin = 0; begin < points.size(); begin += grain)
+        {
+            std::size_t end = std::min(points.size(), begin + grain);
+            auto [task, future] = stone::make_once_task([&points, begin, end]()
+                                                        { filter_points(points, begin, end); });
+            pool.push(task);
+            futures.push_back(std::move(future));
+        }
+        for (auto &&future : futures)
+        {
+            future.wait();
+        }
+        futures.clear();
+    }
+    return bench_elapsed_sec(t0) * 1e6 / rounds;
+}
+
+static double parallel_for_rounds(stone::ThreadPool &pool, std::vector<float> &points, std::size_t grain, std::size_t rounds)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; r++)
+    {
+        stone::parallel_for(0, points.size(), grain, [&points](std::size_t begin, std::size_t end)
+                            { filter_points(points, begin, end); },
+                            &pool);
+    }
+    return bench_elapsed_sec(t0) * 1e6 / rounds;
+}
+
+static double sequential_rounds(std::vector<float> &points, std::size_t rounds)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; r++)
+    {
+        filter_points(points, 0, points.size());
+    }
+    return bench_elapsed_sec(t0) * 1e6 / rounds;
+}
+
+// every worker of the pool runs a task that calls parallel_reduce itself
+static double nested_reduce(stone::ThreadPool &pool, const std::vector<float> &points, std::size_t grain, double &error)
+{
+    std::vector<std::future<double>> futures;
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t w = 0; w < pool.size(); w++)
+    {
+        auto [task, future] = stone::make_once_task([&points, &pool, grain]()
+                                                    { return stone::parallel_reduce(
+                                                          0, points.size(), grain, 0.0,
+                                                          [&points](std::size_t begin, std::size_t end, double acc)
+                                                          {
+                                                              for (std::size_t i = begin; i < end; i++)
+                                                              {
+                                                                  acc += points[i];
+                                                              }
+                                                              return acc;
+                                                          },
+                                                          [](double a, double b)
+                                                          { return a + b; },
+                                                          &pool); });
+        pool.push(task);
+        futures.push_back(std::move(future));
+    }
+    double expected = 0;
+    for (auto &&p : points)
+    {
+        expected += p;
+    }
+    error = 0;
+    for (auto &&future : futures)
+    {
+        error = std::max(error, std::abs(future.get() - expected) / expected);
+    }
+    return bench_elapsed_sec(t0) * 1e6;
+}
+
+void bench_parallel()
+{
+    const std::size_t rounds = 100;
+    std::vector<float> points(1 << 20, 1.0f);
+    stone::ThreadPool pool(4);
+    bench_report("filter", {{"points", "1M"}}, "sequential", sequential_rounds(points, rounds), "us");
+    for (std::size_t grain : {1024, 16384})
+    {
+        bench_params params = {{"points", "1M"}, {"grain", std::to_string(grain)}, {"workers", "4"}};
+        bench_report("filter", params, "per_chunk_tasks", per_chunk_tasks(pool, points, grain, rounds), "us");
+        bench_report("filter", params, "parallel_for", parallel_for_rounds(pool, points, grain, rounds), "us");
+    }
+    double error = 0;
+    double us = nested_reduce(pool, points, 4096, error);
+    bench_params params = {{"points", "1M"}, {"callers", "4"}, {"workers", "4"}};
+    bench_report("nested_reduce", params, "time", us, "us");
+    bench_report("nested_reduce", params, "relative_error", error, "");
+}
@@ -0,0 +1,105 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <filesystem>
+#include <thread>
+
+struct bench_record_msg_t
+{
+    uint64_t seq;
+    double values[16];
+};
+
+// publishes count messages at rate msg/s to a topic with one subscriber and records the cost of
+// every publish call, with or without a recorder on the topic.
+static void record_overhead(const std::string &directory, bool recording, std::size_t rate, std::size_t count)
+{
+    const std::string topic = "bench_record";
+    auto sub = stone::subscribe<bench_record_msg_t>(topic, [](const std::shared_ptr<bench_record_msg_t> &) {}, 64);
+    stone::Recorder recorder(directory);
+    recorder.record<bench_record_msg_t>(topic);
+    if (recording && !recorder.start())
+    {
+        bench_report("record_overhead", {}, "unavailable", 1, "");
+        stone::unsubscribe(sub);
+        return;
+    }
+    auto handle = stone::advertise<bench_record_msg_t>(topic, 64);
+    stone::LatencyHistogram cost;
+    auto interval = std::chrono::nanoseconds(1000000000 / rate);
+    auto next = stone::timepoint_now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto msg = handle.loan();
+        if (msg == nullptr)
+        {
+            msg = std::make_shared<bench_record_msg_t>();
+        }
+        msg->seq = i;
+        auto t0 = stone::timepoint_now();
+        stone::publish(handle, msg);
+        cost.record(stone::elapsed_ns(t0, stone::timepoint_now()));
+        msg = nullptr;
+        sub->spin();
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+    recorder.stop();
+    stone::unsubscribe(sub);
+    bench_params params = {{"recorder", recording ? "on" : "off"}, {"rate", std::to_string(rate)}};
+    bench_report("record_overhead", params, "publish", cost);
+    if (recording)
+    {
+        auto stats = recorder.stats();
+        bench_report("record_overhead", params, "recorded", double(stats.recorded), "msg");
+        bench_report("record_overhead", params, "dropped", double(stats.dropped), "msg");
+        bench_report("record_overhead", params, "bytes", double(stats.bytes), "B");
+    }
+}
+
+// plays the log recorded by record_overhead back into a subscriber
+static void replay(const std::string &directory, double speed, std::size_t recorded_count, std::size_t rate)
+{
+    std::atomic<std::size_t> received{0};
+    auto sub = stone::subscribe<bench_record_msg_t>("bench_record", [&received](const std::shared_ptr<bench_record_msg_t> &)
+                                                    { received++; },
+                                                    1024);
+    stone::Replayer replayer(directory);
+    replayer.replay<bench_record_msg_t>("bench_record");
+    std::atomic<bool> playing{true};
+    std::thread drainer([&]()
+                        {
+                            while (playing)
+                            {
+                                sub->spin_some(1024);
+                            }
+                            sub->spin_some(1024); });
+    auto t0 = std::chrono::steady_clock::now();
+    std::size_t published = replayer.play(speed);
+    double sec = bench_elapsed_sec(t0);
+    playing = false;
+    drainer.join();
+    stone::unsubscribe(sub);
+    bench_params params = {{"speed", speed > 0 ? std::to_string(int(speed)) : "max"}};
+    bench_report("replay", params, "published", double(published), "msg");
+    bench_report("replay", params, "received", double(received), "msg");
+    bench_report("replay", params, "rate", published / sec, "msg/s");
+    if (speed > 0)
+    {
+        // the recording spans recorded_count - 1 intervals
+        double expected = (recorded_count - 1) / double(rate) / speed;
+        bench_report("replay", params, "timing_error", (sec - expected) * 1e6, "us");
+    }
+}
+
+void bench_record()
+{
+    const std::string directory = (std::filesystem::temp_directory_path() / "stone_bench_record").string();
+    const std::size_t rate = 10000, count = 10000;
+    record_overhead(directory, false, rate, count);
+    record_overhead(directory, true, rate, count);
+    replay(directory, 0, count, rate);
+    replay(directory, 1, count, rate);
+    replay(directory, 4, count, rate);
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+}
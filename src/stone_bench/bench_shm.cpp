@@ -0,0 +1,144 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <thread>
+
+#ifdef __linux__
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct bench_shm_msg_t
+{
+    uint64_t seq;
+    std::chrono::steady_clock::time_point sent;
+    double values[8];
+};
+
+// what the subscriber process sends back through the pipe
+struct bench_shm_result_t
+{
+    uint64_t received;
+    uint64_t lost;
+    uint64_t p50, p99, p999, max;
+};
+
+static const uint64_t BENCH_SHM_END = ~uint64_t(0);
+
+// the child process subscribes through shared memory and records publish-to-callback latency
+static void shm_subscriber_process(const std::string &topic, std::size_t capacity, int fd)
+{
+    stone::LatencyHistogram latency;
+    uint64_t received = 0;
+    bool done = false;
+    auto sub = stone::subscribe<bench_shm_msg_t>(topic, [&](const std::shared_ptr<bench_shm_msg_t> &msg)
+                                                 {
+                                                     if (msg->seq == BENCH_SHM_END)
+                                                     {
+                                                         done = true;
+                                                         return;
+                                                     }
+                                                     latency.record(stone::elapsed_ns(msg->sent, stone::timepoint_now()));
+                                                     received++; },
+                                                 stone::Transport::SHM, capacity);
+    char ready = sub != nullptr ? 1 : 0;
+    if (write(fd, &ready, 1) != 1 || sub == nullptr)
+    {
+        _exit(1);
+    }
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!done && std::chrono::steady_clock::now() < give_up)
+    {
+        sub->spin_some(64);
+    }
+    auto s = latency.snapshot();
+    bench_shm_result_t result = {received, sub->remote_lost(), s.percentile(50), s.percentile(99), s.percentile(99.9), s.max};
+    _exit(write(fd, &result, sizeof(result)) == sizeof(result) ? 0 : 1);
+}
+
+// publishes count messages to a subscriber in another process, one every interval_us
+// or back to back when it is 0.
+static void shm_roundtrip(std::size_t count, unsigned interval_us, std::size_t capacity)
+{
+    const std::string topic = "bench_shm_" + std::to_string(interval_us);
+    stone::unlink_shared(topic);
+    if (!stone::share<bench_shm_msg_t>(topic, capacity))
+    {
+        bench_report("shm_roundtrip", {}, "unavailable", 1, "");
+        return;
+    }
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        shm_subscriber_process(topic, capacity, fds[1]);
+    }
+    close(fds[1]);
+    char ready = 0;
+    if (pid < 0 || read(fds[0], &ready, 1) != 1 || ready != 1)
+    {
+        close(fds[0]);
+        if (pid > 0)
+        {
+            waitpid(pid, nullptr, 0);
+        }
+        return;
+    }
+
+    auto topic_handle = stone::advertise<bench_shm_msg_t>(topic);
+    auto msg = std::make_shared<bench_shm_msg_t>();
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        msg->seq = i;
+        msg->sent = stone::timepoint_now();
+        stone::publish(topic_handle, msg);
+        if (interval_us > 0)
+        {
+            auto next = msg->sent + std::chrono::microseconds(interval_us);
+            while (stone::timepoint_now() < next)
+            {
+            }
+        }
+    }
+    double rate = count / bench_elapsed_sec(t0);
+    // let the subscriber catch up, so the end marker does not overwrite unread messages
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    msg->seq = BENCH_SHM_END;
+    stone::publish(topic_handle, msg);
+
+    bench_shm_result_t result = {};
+    bool ok = read(fds[0], &result, sizeof(result)) == sizeof(result);
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    stone::unlink_shared(topic);
+    if (!ok)
+    {
+        return;
+    }
+    bench_params params = {{"interval_us", std::to_string(interval_us)}, {"capacity", std::to_string(capacity)}};
+    bench_report("shm_roundtrip", params, "published", rate, "msg/s");
+    bench_report("shm_roundtrip", params, "received", double(result.received), "msg");
+    bench_report("shm_roundtrip", params, "lost", double(result.lost), "msg");
+    bench_report("shm_roundtrip", params, "latency.p50", double(result.p50), "ns");
+    bench_report("shm_roundtrip", params, "latency.p99", double(result.p99), "ns");
+    bench_report("shm_roundtrip", params, "latency.p99.9", double(result.p999), "ns");
+    bench_report("shm_roundtrip", params, "latency.max", double(result.max), "ns");
+}
+
+void bench_shm()
+{
+    shm_roundtrip(20000, 50, 1024);
+    shm_roundtrip(1000000, 0, 1024);
+}
+
+#else
+
+void bench_shm()
+{
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <random>
+#include <thread>
+
+struct bench_camera_t
+{
+    uint64_t stamp_ns;
+    uint8_t pixels[256];
+};
+
+struct bench_lidar_t
+{
+    uint64_t stamp_ns;
+    float points[64];
+};
+
+struct bench_imu_t
+{
+    uint64_t stamp_ns;
+    double values[6];
+};
+
+static uint64_t stamp_ns(const std::chrono::steady_clock::time_point &tp)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+}
+
+// publishes camera, lidar and imu messages at rate Hz for count periods and spins the
+// synchronizer after every period. jitter_ns shifts the lidar and imu stamps randomly,
+// executor lets a pool match instead of spinning.
+static void sync_rate(stone::SyncPolicy policy, uint64_t jitter_ns, std::size_t rate, std::size_t count, bool executor)
+{
+    const uint64_t period_ns = 1000000000 / rate;
+    stone::ThreadPool pool(1);
+    stone::sync_options options;
+    options.policy = policy;
+    options.slop = period_ns / 4;
+    options.pool = executor ? &pool : nullptr;
+    stone::LatencyHistogram latency;
+    stone::Synchronizer<bench_camera_t, bench_lidar_t, bench_imu_t> sync(
+        {"bench_sync/camera", "bench_sync/lidar", "bench_sync/imu"},
+        [](const auto &msg)
+        { return msg.stamp_ns; },
+        [&latency](const std::shared_ptr<bench_camera_t> &camera, const std::shared_ptr<bench_lidar_t> &,
+                   const std::shared_ptr<bench_imu_t> &)
+        { latency.record(stamp_ns(stone::timepoint_now()) - camera->stamp_ns); },
+        options);
+    auto camera = stone::advertise<bench_camera_t>("bench_sync/camera", 16);
+    auto lidar = stone::advertise<bench_lidar_t>("bench_sync/lidar", 16);
+    auto imu = stone::advertise<bench_imu_t>("bench_sync/imu", 16);
+
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int64_t> jitter(-int64_t(jitter_ns), int64_t(jitter_ns));
+    stone::LatencyHistogram match_cost;
+    auto next = stone::timepoint_now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        uint64_t stamp = stamp_ns(next);
+        // loans come back once the synchronizer matched or dropped the message
+        auto c = camera.loan();
+        auto l = lidar.loan();
+        auto m = imu.loan();
+        if (c == nullptr || l == nullptr || m == nullptr)
+        {
+            c = std::make_shared<bench_camera_t>();
+            l = std::make_shared<bench_lidar_t>();
+            m = std::make_shared<bench_imu_t>();
+        }
+        c->stamp_ns = stamp;
+        l->stamp_ns = stamp + jitter(rng);
+        m->stamp_ns = stamp + jitter(rng);
+        stone::publish(camera, c);
+        stone::publish(lidar, l);
+        stone::publish(imu, m);
+        c = nullptr;
+        l = nullptr;
+        m = nullptr;
+        if (!executor)
+        {
+            auto t0 = stone::timepoint_now();
+            std::size_t n = sync.spin();
+            if (n > 0)
+            {
+                match_cost.record(stone::elapsed_ns(t0, stone::timepoint_now()) / n);
+            }
+        }
+        next += std::chrono::nanoseconds(period_ns);
+        std::this_thread::sleep_until(next);
+    }
+    while (!sync.idle())
+    {
+        std::this_thread::yield();
+    }
+    bench_params params = {{"policy", policy == stone::SyncPolicy::EXACT ? "exact" : "approximate"},
+                           {"rate", std::to_string(rate)},
+                           {"jitter_us", std::to_string(jitter_ns / 1000)},
+                           {"driver", executor ? "pool" : "spin"}};
+    bench_report("sync", params, "matched", double(sync.matched()), "tuples");
+    bench_report("sync", params, "dropped", double(sync.dropped()), "msg");
+    if (!executor)
+    {
+        bench_report("sync", params, "match_cost", match_cost);
+    }
+    bench_report("sync", params, "camera_to_callback", latency);
+}
+
+void bench_sync()
+{
+    const std::size_t rate = 1000, count = 2000;
+    sync_rate(stone::SyncPolicy::EXACT, 0, rate, count, false);
+    sync_rate(stone::SyncPolicy::APPROXIMATE, 100000, rate, count, false);
+    sync_rate(stone::SyncPolicy::APPROXIMATE, 100000, rate, count, true);
+}
@@ -0,0 +1,238 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <algorithm>
+#include <random>
+#include <thread>
+
+static const char *mode_name(stone::ThreadPool::QueueMode mode)
+{
+    return mode == stone::ThreadPool::QueueMode::SHARED ? "shared" : "stealing";
+}
+
+static void wait_done(const std::atomic<std::size_t> &done, std::size_t expected)
+{
+    while (done.load() < expected)
+    {
+        std::this_thread::yield();
+    }
+}
+
+// every task is pushed from the main thread.
+static double external_push(stone::ThreadPool::QueueMode mode, std::size_t workers, std::size_t count)
+{
+    std::atomic<std::size_t> done{0};
+    std::vector<std::shared_ptr<stone::WorkItem>> items(count);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        items[i] = std::make_shared<stone::WorkItem>();
+        items[i]->fn = [&done]()
+        { done++; };
+        items[i]->set_priority(i % 4);
+    }
+
+    stone::ThreadPool pool(workers, mode);
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto &&item : items)
+    {
+        pool.push(item);
+    }
+    wait_done(done, count);
+    return count / bench_elapsed_sec(t0);
+}
+
+// a few seed tasks, each of them pushes its children from inside a worker.
+static double worker_fanout(stone::ThreadPool::QueueMode mode, std::size_t workers,
+                            std::size_t seeds, std::size_t children)
+{
+    std::atomic<std::size_t> done{0};
+    stone::ThreadPool pool(workers, mode);
+    std::vector<std::shared_ptr<stone::WorkItem>> seed_items(seeds);
+    std::vector<std::vector<std::shared_ptr<stone::WorkItem>>> child_items(seeds);
+    for (std::size_t s = 0; s < seeds; s++)
+    {
+        for (std::size_t c = 0; c < children; c++)
+        {
+            auto child = std::make_shared<stone::WorkItem>();
+            child->fn = [&done]()
+            { done++; };
+            child_items[s].push_back(child);
+        }
+        seed_items[s] = std::make_shared<stone::WorkItem>();
+        auto *own_children = &child_items[s];
+        seed_items[s]->fn = [&pool, &done, own_children]()
+        {
+            for (auto &&child : *own_children)
+            {
+                pool.push(child);
+            }
+            done++;
+        };
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto &&seed : seed_items)
+    {
+        pool.push(seed);
+    }
+    wait_done(done, seeds * (children + 1));
+    return seeds * (children + 1) / bench_elapsed_sec(t0);
+}
+
+// a 1ms control task competes with slow logging tasks, either on the same pool
+// or on a pool of its own. reports how long the control task waits for a worker.
+static void pool_isolation(bool own_pool)
+{
+    stone::ThreadPool logging_pool(2);
+    stone::ThreadPool::Config config;
+    config.name = "bench_ctrl";
+    config.threads = 1;
+    config.prefault_stack = 64 * 1024;
+    stone::ThreadPool control_pool(config);
+    stone::Scheduler scheduler(&logging_pool);
+    std::thread th([&scheduler]()
+                   { scheduler.run(); });
+
+    auto control = stone::make_interval_task([]() {});
+    auto stats = control->enable_stats();
+    if (own_pool)
+    {
+        control->set_pool(&control_pool);
+    }
+    scheduler.scheduleInterval(control, 1_ms);
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+    while (std::chrono::steady_clock::now() < until)
+    {
+        logging_pool.submit([]()
+                            { std::this_thread::sleep_for(std::chrono::milliseconds(2)); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    scheduler.shutdown();
+    th.join();
+    logging_pool.shutdown();
+    control_pool.shutdown();
+    bench_report("pool_isolation", {{"control_pool", own_pool ? "own" : "shared"}}, "queued", stats->queued);
+}
+
+// a 1ms control task of priority 0 competes with 20ms planning tasks that keep both
+// workers busy, with or without a worker reserved for the urgent band.
+static void priority_bands(bool reserved)
+{
+    stone::ThreadPool::Config config;
+    config.name = "bench_band";
+    config.threads = 2;
+    if (reserved)
+    {
+        config.bands = {{0, 1}, {~std::size_t(0), 0}};
+        config.band_stats = true;
+    }
+    stone::ThreadPool pool(config);
+    stone::Scheduler scheduler(&pool);
+    std::thread th([&scheduler]()
+                   { scheduler.run(); });
+
+    auto control = stone::make_interval_task([]() {});
+    control->set_priority(0);
+    auto stats = control->enable_stats();
+    scheduler.scheduleInterval(control, 1_ms);
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+    while (std::chrono::steady_clock::now() < until)
+    {
+        auto planning = std::make_shared<stone::WorkItem>();
+        planning->fn = []()
+        { std::this_thread::sleep_for(std::chrono::milliseconds(20)); };
+        planning->set_priority(10);
+        pool.push(planning);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    scheduler.shutdown();
+    th.join();
+    pool.shutdown();
+    bench_params params = {{"reserved", reserved ? "1" : "0"}};
+    bench_report("priority_bands", params, "control_queued", stats->queued);
+    if (reserved)
+    {
+        bench_report("priority_bands", params, "band0_wait", *pool.bandQueueWait(0));
+        bench_report("priority_bands", params, "band1_wait", *pool.bandQueueWait(1));
+    }
+}
+
+static void busy_for(std::chrono::microseconds duration)
+{
+    auto until = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < until)
+    {
+    }
+}
+
+// a burst of 50us tasks is queued on one worker, their static priority follows the
+// submission order. task k is due (k + 1) * 100us after the burst starts and is submitted
+// at a random position, so the burst is feasible when the earliest deadline runs first.
+static void deadline_order(stone::ThreadPool::OrderPolicy order, std::size_t count)
+{
+    stone::ThreadPool pool(1, stone::ThreadPool::QueueMode::SHARED, order);
+    std::atomic<bool> gate{false};
+    std::atomic<std::size_t> done{0};
+    pool.submit([&gate]()
+                {
+                    while (!gate.load())
+                    {
+                        std::this_thread::yield();
+                    } });
+
+    std::vector<std::size_t> slots(count);
+    for (std::size_t k = 0; k < count; k++)
+    {
+        slots[k] = k;
+    }
+    std::shuffle(slots.begin(), slots.end(), std::mt19937(42));
+    auto start = std::chrono::steady_clock::now() + std::chrono::milliseconds(5);
+    std::vector<std::shared_ptr<stone::WorkItem>> items;
+    for (std::size_t k : slots)
+    {
+        auto item = std::make_shared<stone::WorkItem>();
+        item->fn = [&done]()
+        {
+            busy_for(std::chrono::microseconds(50));
+            done++;
+        };
+        item->set_deadline(start + std::chrono::microseconds(100 * (k + 1)));
+        item->set_priority(items.size());
+        items.push_back(item);
+    }
+    pool.push_bulk(items.begin(), items.end());
+    std::this_thread::sleep_until(start);
+    gate = true;
+    wait_done(done, count);
+
+    uint64_t misses = 0;
+    for (auto &&item : items)
+    {
+        misses += item->deadline_misses();
+    }
+    bench_report("deadline_order", {{"order", order == stone::ThreadPool::OrderPolicy::EDF ? "edf" : "priority"},
+                                    {"tasks", std::to_string(count)}},
+                 "misses", double(misses), "tasks");
+}
+
+void bench_threadpool()
+{
+    const stone::ThreadPool::QueueMode modes[] = {stone::ThreadPool::QueueMode::SHARED,
+                                                  stone::ThreadPool::QueueMode::WORK_STEALING};
+    for (std::size_t workers : {1, 2, 4, 8})
+    {
+        for (auto mode : modes)
+        {
+            double external = external_push(mode, workers, 100000);
+            double fanout = worker_fanout(mode, workers, 64, 1000);
+            bench_params params = {{"mode", mode_name(mode)}, {"workers", std::to_string(workers)}};
+            bench_report("external_push", params, "throughput", external, "ops/s");
+            bench_report("worker_fanout", params, "throughput", fanout, "ops/s");
+        }
+    }
+    pool_isolation(false);
+    pool_isolation(true);
+    priority_bands(false);
+    priority_bands(true);
+    deadline_order(stone::ThreadPool::OrderPolicy::PRIORITY, 200);
+    deadline_order(stone::ThreadPool::OrderPolicy::EDF, 200);
+}
@@ -0,0 +1,182 @@
+#include "stone_bench.hpp"
+#include "stone/stone.hpp"
+#include <random>
+#include <thread>
+
+using time_point = std::chrono::steady_clock::time_point;
+
+// the binary heap the Scheduler uses for its HEAP backend
+class HeapTimers
+{
+private:
+    using entry = std::pair<time_point, std::size_t>;
+    class Compare
+    {
+    public:
+        bool operator()(const entry &a, const entry &b)
+        {
+            return a.first > b.first;
+        }
+    };
+    std::priority_queue<entry, std::vector<entry>, Compare> heap;
+
+public:
+    void insert(std::size_t value, const time_point &tp)
+    {
+        heap.push(entry(tp, value));
+    }
+
+    void advance(const time_point &tp, std::vector<std::size_t> &due)
+    {
+        while (!heap.empty() && heap.top().first <= tp)
+        {
+            due.push_back(heap.top().second);
+            heap.pop();
+        }
+    }
+};
+
+// simulates a timer backend for 100 ms of periodic timers with periods of 1, 10 and 100 ms.
+// returns the cost of one expire plus re-arm in ns.
+template <class Timers>
+static double periodic_cost(Timers &timers, std::size_t count, const time_point &t_begin)
+{
+    const std::chrono::microseconds periods[] = {std::chrono::microseconds(1_ms),
+                                                 std::chrono::microseconds(10_ms),
+                                                 std::chrono::microseconds(100_ms)};
+    std::mt19937 rng(1);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        timers.insert(i, t_begin + std::chrono::microseconds(rng() % 100000));
+    }
+
+    std::vector<std::size_t> due;
+    std::size_t ops = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto now = t_begin; now < t_begin + std::chrono::milliseconds(100); now += std::chrono::microseconds(100))
+    {
+        timers.advance(now, due);
+        for (auto &&i : due)
+        {
+            timers.insert(i, now + periods[i % 3]);
+        }
+        ops += due.size();
+        due.clear();
+    }
+    return ops ? bench_elapsed_sec(t0) * 1e9 / ops : 0;
+}
+
+// inserts one-shot timers spread over one second and expires all of them.
+// returns the cost of one insert plus expire in ns.
+template <class Timers>
+static double oneshot_cost(Timers &timers, std::size_t count, const time_point &t_begin)
+{
+    std::vector<time_point> deadlines(count);
+    std::mt19937 rng(2);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        deadlines[i] = t_begin + std::chrono::microseconds(rng() % 1000000);
+    }
+
+    std::vector<std::size_t> due;
+    due.reserve(count);
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        timers.insert(i, deadlines[i]);
+    }
+    for (auto now = t_begin; due.size() < count; now += std::chrono::microseconds(100))
+    {
+        timers.advance(now, due);
+    }
+    return bench_elapsed_sec(t0) * 1e9 / count;
+}
+
+// runs interval tasks through a real Scheduler and counts the executions.
+static std::size_t scheduler_runs(stone::Scheduler::TimerBackend backend, std::size_t count)
+{
+    stone::ThreadPool pool(2);
+    stone::Scheduler scheduler(&pool, backend);
+    std::thread th([&scheduler]()
+                   { scheduler.run(); });
+    std::atomic<std::size_t> runs{0};
+    std::vector<std::shared_ptr<stone::WorkItem>> tasks;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto task = stone::make_interval_task([&runs]()
+                                              { runs++; });
+        scheduler.scheduleInterval(task, 10_ms);
+        tasks.push_back(task);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    scheduler.shutdown();
+    th.join();
+    pool.shutdown();
+    return runs;
+}
+
+// keeps count one-shot timers armed a second ahead and cancels or moves one of them per
+// operation, as a watchdog that is fed on every message would. returns the cost of one
+// cancel or reschedule in ns and the live timer count at the end.
+static std::pair<double, std::size_t> cancel_churn(stone::Scheduler::TimerBackend backend, std::size_t count, std::size_t ops)
+{
+    stone::ThreadPool pool(1);
+    stone::Scheduler scheduler(&pool, backend);
+    std::thread th([&scheduler]()
+                   { scheduler.run(); });
+    std::vector<std::shared_ptr<stone::WorkItem>> tasks;
+    std::vector<stone::TaskHandle> handles;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto task = std::get<0>(stone::make_once_task([]() {}));
+        handles.push_back(scheduler.scheduleAt(task, stone::timepoint_shift(1_sec)));
+        tasks.push_back(task);
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < ops; i++)
+    {
+        auto &handle = handles[i % count];
+        if (i % 2 == 0)
+        {
+            handle.cancel();
+        }
+        handle.reschedule(stone::timepoint_shift(1_sec));
+    }
+    double cost = bench_elapsed_sec(t0) * 1e9 / ops;
+    std::size_t live = scheduler.timerCount();
+    scheduler.shutdown();
+    th.join();
+    pool.shutdown();
+    return {cost, live};
+}
+
+void bench_timer()
+{
+    for (std::size_t count : {10, 1000, 100000})
+    {
+        auto t_begin = std::chrono::steady_clock::now();
+        HeapTimers heap_once, heap_periodic;
+        stone::TimingWheel<std::size_t> wheel_once(100, t_begin), wheel_periodic(100, t_begin);
+        std::string timers = std::to_string(count);
+        bench_report("oneshot", {{"timers", timers}, {"backend", "heap"}}, "cost",
+                     oneshot_cost(heap_once, count, t_begin), "ns/timer");
+        bench_report("oneshot", {{"timers", timers}, {"backend", "wheel"}}, "cost",
+                     oneshot_cost(wheel_once, count, t_begin), "ns/timer");
+        bench_report("periodic", {{"timers", timers}, {"backend", "heap"}}, "cost",
+                     periodic_cost(heap_periodic, count, t_begin), "ns/expiry");
+        bench_report("periodic", {{"timers", timers}, {"backend", "wheel"}}, "cost",
+                     periodic_cost(wheel_periodic, count, t_begin), "ns/expiry");
+    }
+    // 100 interval tasks at 10ms for 200ms
+    bench_report("scheduler_runs", {{"tasks", "100"}, {"backend", "heap"}}, "runs",
+                 double(scheduler_runs(stone::Scheduler::TimerBackend::HEAP, 100)), "runs");
+    bench_report("scheduler_runs", {{"tasks", "100"}, {"backend", "wheel"}}, "runs",
+                 double(scheduler_runs(stone::Scheduler::TimerBackend::WHEEL, 100)), "runs");
+    for (auto backend : {stone::Scheduler::TimerBackend::HEAP, stone::Scheduler::TimerBackend::WHEEL})
+    {
+        bench_params params = {{"timers", "1000"}, {"backend", backend == stone::Scheduler::TimerBackend::HEAP ? "heap" : "wheel"}};
+        auto churn = cancel_churn(backend, 1000, 1000000);
+        bench_report("cancel_churn", params, "cost", churn.first, "ns/op");
+        bench_report("cancel_churn", params, "live_timers", double(churn.second), "timers");
+    }
+}
@@ -0,0 +1,160 @@
+#include "stone_bench.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <thread>
+
+struct bench_case
+{
+    const char *name;
+    std::function<void()> fn;
+};
+
+struct bench_result
+{
+    std::string suite;
+    std::string case_name;
+    bench_params params;
+    std::string metric;
+    double value;
+    std::string unit;
+};
+
+static const bench_case bench_cases[] = {
+    {"threadpool", bench_threadpool},
+    {"latency", bench_latency},
+    {"timer", bench_timer},
+    {"jitter", bench_jitter},
+    {"datafly", bench_datafly},
+    {"event", bench_event},
+    {"graph", bench_graph},
+    {"alloc", bench_alloc},
+    {"coroutine", bench_coroutine},
+    {"shm", bench_shm},
+    {"record", bench_record},
+    {"parallel", bench_parallel},
+    {"sync", bench_sync},
+};
+
+static std::string current_suite;
+static std::vector<bench_result> results;
+
+void bench_report(const std::string &case_name, const bench_params &params,
+                  const std::string &metric, double value, const std::string &unit)
+{
+    std::string param_text;
+    for (auto &&p : params)
+    {
+        param_text += p.first + "=" + p.second + " ";
+    }
+    printf("%-12s %-18s %-48s %-18s %14.1f %s\r\n", current_suite.c_str(), case_name.c_str(),
+           param_text.c_str(), metric.c_str(), value, unit.c_str());
+    results.push_back(bench_result{current_suite, case_name, params, metric, value, unit});
+}
+
+void bench_report(const std::string &case_name, const bench_params &params,
+                  const std::string &metric, const stone::LatencyHistogram &histogram)
+{
+    auto s = histogram.snapshot();
+    bench_report(case_name, params, metric + ".count", double(s.count), "");
+    bench_report(case_name, params, metric + ".p50", double(s.percentile(50)), "ns");
+    bench_report(case_name, params, metric + ".p99", double(s.percentile(99)), "ns");
+    bench_report(case_name, params, metric + ".p99.9", double(s.percentile(99.9)), "ns");
+    bench_report(case_name, params, metric + ".max", double(s.max), "ns");
+}
+
+static std::string json_string(const std::string &text)
+{
+    std::string out = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+static bool write_json(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == nullptr)
+    {
+        return false;
+    }
+    fprintf(f, "{\n  \"timestamp\": %lld,\n  \"hardware_concurrency\": %u,\n  \"results\": [",
+            (long long)time(nullptr), std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        auto &&r = results[i];
+        fprintf(f, "%s\n    {\"suite\": %s, \"case\": %s, \"params\": {", i ? "," : "",
+                json_string(r.suite).c_str(), json_string(r.case_name).c_str());
+        for (std::size_t p = 0; p < r.params.size(); p++)
+        {
+            fprintf(f, "%s%s: %s", p ? ", " : "", json_string(r.params[p].first).c_str(),
+                    json_string(r.params[p].second).c_str());
+        }
+        fprintf(f, "}, \"metric\": %s, \"value\": ", json_string(r.metric).c_str());
+        // JSON has no nan or inf
+        if (std::isfinite(r.value))
+        {
+            fprintf(f, "%.6g", r.value);
+        }
+        else
+        {
+            fprintf(f, "null");
+        }
+        fprintf(f, ", \"unit\": %s}", json_string(r.unit).c_str());
+    }
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+    return true;
+}
+
+// usage: stone_bench [--json path] [benchmark...]
+// runs every benchmark, or only the named ones, and writes the results to stone_bench.json.
+int main(int argc, char *argv[])
+{
+    const char *json_path = "stone_bench.json";
+    std::vector<const char *> names;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            json_path = argv[++i];
+        }
+        else
+        {
+            names.push_back(argv[i]);
+        }
+    }
+
+    for (auto &&c : bench_cases)
+    {
+        bool selected = names.empty();
+        for (auto &&name : names)
+        {
+            if (strcmp(name, c.name) == 0)
+            {
+                selected = true;
+            }
+        }
+        if (selected)
+        {
+            current_suite = c.name;
+            c.fn();
+        }
+    }
+
+    if (!write_json(json_path))
+    {
+        printf("cannot write %s\r\n", json_path);
+        return 1;
+    }
+    printf("results written to %s\r\n", json_path);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef STONE_BENCH_HPP
+#define STONE_BENCH_HPP
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stone/histogram.hpp"
+
+inline double bench_elapsed_sec(const std::chrono::steady_clock::time_point &t0)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// parameters of a measurement, e.g. {{"workers", "4"}, {"mode", "shared"}}
+using bench_params = std::vector<std::pair<std::string, std::string>>;
+
+// records one measurement of the running benchmark.
+// it is printed right away and written to the JSON report when all benchmarks are done.
+void bench_report(const std::string &case_name, const bench_params &params,
+                  const std::string &metric, double value, const std::string &unit);
+
+// reports count, p50, p99, p99.9 and max of a histogram of nanosecond values.
+void bench_report(const std::string &case_name, const bench_params &params,
+                  const std::string &metric, const stone::LatencyHistogram &histogram);
+
+void bench_threadpool();
+void bench_timer();
+void bench_datafly();
+void bench_event();
+void bench_graph();
+void bench_alloc();
+void bench_jitter();
+void bench_latency();
+void bench_coroutine();
+void bench_shm();
+void bench_record();
+void bench_parallel();
+void bench_sync();
+
+#endif